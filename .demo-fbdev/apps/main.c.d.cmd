@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1   -Iinclude -M apps/main.c | sed 's,\(main\.o\) *:,.demo-fbdev/apps/ .demo-fbdev/apps/main.c.d: ,' > .demo-fbdev/apps/main.c.d; cp -rf .demo-fbdev/apps/main.c.d .demo-fbdev/apps/main.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .demo-fbdev/apps/main.c.d >> .demo-fbdev/apps/main.c.d.p; mv .demo-fbdev/apps/main.c.d.p .demo-fbdev/apps/main.c.d
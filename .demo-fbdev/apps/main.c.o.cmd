@@ -0,0 +1 @@
+/usr/bin/cc  -Wall -Wextra -O2 -include config.h -D__LINUX__=1    -Iinclude -c -o .demo-fbdev/apps/main.c.o apps/main.c
@@ -0,0 +1 @@
+/usr/bin/cc  -Wall -Wextra -O2 -include config.h -D__LINUX__=1 -L./ -o .demo-fbdev/demo-fbdev .demo-fbdev/apps/main.c.o  libapps.a libtwin.a -pthread -ljpeg  -lpng16  -ludev  
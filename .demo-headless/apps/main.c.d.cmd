@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1   -Iinclude -M apps/main.c | sed 's,\(main\.o\) *:,.demo-headless/apps/ .demo-headless/apps/main.c.d: ,' > .demo-headless/apps/main.c.d; cp -rf .demo-headless/apps/main.c.d .demo-headless/apps/main.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .demo-headless/apps/main.c.d >> .demo-headless/apps/main.c.d.p; mv .demo-headless/apps/main.c.d.p .demo-headless/apps/main.c.d
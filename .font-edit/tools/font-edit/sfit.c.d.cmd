@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1   -Itools/font-edit -M tools/font-edit/sfit.c | sed 's,\(sfit\.o\) *:,.font-edit/tools/font-edit/ .font-edit/tools/font-edit/sfit.c.d: ,' > .font-edit/tools/font-edit/sfit.c.d; cp -rf .font-edit/tools/font-edit/sfit.c.d .font-edit/tools/font-edit/sfit.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .font-edit/tools/font-edit/sfit.c.d >> .font-edit/tools/font-edit/sfit.c.d.p; mv .font-edit/tools/font-edit/sfit.c.d.p .font-edit/tools/font-edit/sfit.c.d
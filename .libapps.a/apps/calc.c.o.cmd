@@ -0,0 +1 @@
+/usr/bin/cc  -Wall -Wextra -O2 -include config.h -D__LINUX__=1    -Iinclude -c -o .libapps.a/apps/calc.c.o apps/calc.c
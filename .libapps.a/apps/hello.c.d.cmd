@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1   -Iinclude -M apps/hello.c | sed 's,\(hello\.o\) *:,.libapps.a/apps/ .libapps.a/apps/hello.c.d: ,' > .libapps.a/apps/hello.c.d; cp -rf .libapps.a/apps/hello.c.d .libapps.a/apps/hello.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .libapps.a/apps/hello.c.d >> .libapps.a/apps/hello.c.d.p; mv .libapps.a/apps/hello.c.d.p .libapps.a/apps/hello.c.d
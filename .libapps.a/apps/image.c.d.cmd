@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1   -Iinclude -M apps/image.c | sed 's,\(image\.o\) *:,.libapps.a/apps/ .libapps.a/apps/image.c.d: ,' > .libapps.a/apps/image.c.d; cp -rf .libapps.a/apps/image.c.d .libapps.a/apps/image.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .libapps.a/apps/image.c.d >> .libapps.a/apps/image.c.d.p; mv .libapps.a/apps/image.c.d.p .libapps.a/apps/image.c.d
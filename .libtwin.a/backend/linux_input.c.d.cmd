@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1 -I/usr/include/libpng16   -Iinclude -Isrc -M backend/linux_input.c | sed 's,\(linux_input\.o\) *:,.libtwin.a/backend/ .libtwin.a/backend/linux_input.c.d: ,' > .libtwin.a/backend/linux_input.c.d; cp -rf .libtwin.a/backend/linux_input.c.d .libtwin.a/backend/linux_input.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .libtwin.a/backend/linux_input.c.d >> .libtwin.a/backend/linux_input.c.d.p; mv .libtwin.a/backend/linux_input.c.d.p .libtwin.a/backend/linux_input.c.d
@@ -0,0 +1,2 @@
+ar rcs .libtwin.a/libtwin.a .libtwin.a/backend/fbdev.c.o .libtwin.a/backend/linux_input.c.o .libtwin.a/src/animation.c.o .libtwin.a/src/api.c.o .libtwin.a/src/box.c.o .libtwin.a/src/button.c.o .libtwin.a/src/convolve.c.o .libtwin.a/src/cursor.c.o .libtwin.a/src/dispatch.c.o .libtwin.a/src/draw-builtin.c.o .libtwin.a/src/draw-common.c.o .libtwin.a/src/event.c.o .libtwin.a/src/file.c.o .libtwin.a/src/fixed.c.o .libtwin.a/src/font.c.o .libtwin.a/src/font_default.c.o .libtwin.a/src/frame.c.o .libtwin.a/src/geom.c.o .libtwin.a/src/hull.c.o .libtwin.a/src/icon.c.o .libtwin.a/src/image-gif.c.o .libtwin.a/src/image-jpeg.c.o .libtwin.a/src/image-png.c.o .libtwin.a/src/image-tvg.c.o .libtwin.a/src/image.c.o .libtwin.a/src/label.c.o .libtwin.a/src/log.c.o .libtwin.a/src/matrix.c.o .libtwin.a/src/path.c.o .libtwin.a/src/pattern.c.o .libtwin.a/src/pixmap.c.o .libtwin.a/src/poly.c.o .libtwin.a/src/primitive.c.o .libtwin.a/src/queue.c.o .libtwin.a/src/record.c.o .libtwin.a/src/screen.c.o .libtwin.a/src/spline.c.o .libtwin.a/src/timeout.c.o .libtwin.a/src/toplevel.c.o .libtwin.a/src/trig.c.o .libtwin.a/src/widget.c.o .libtwin.a/src/window.c.o .libtwin.a/src/work.c.o .libtwin.a/src/worker.c.o
+ranlib .libtwin.a/libtwin.a
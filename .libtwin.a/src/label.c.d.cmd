@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1 -I/usr/include/libpng16   -Iinclude -Isrc -M src/label.c | sed 's,\(label\.o\) *:,.libtwin.a/src/ .libtwin.a/src/label.c.d: ,' > .libtwin.a/src/label.c.d; cp -rf .libtwin.a/src/label.c.d .libtwin.a/src/label.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .libtwin.a/src/label.c.d >> .libtwin.a/src/label.c.d.p; mv .libtwin.a/src/label.c.d.p .libtwin.a/src/label.c.d
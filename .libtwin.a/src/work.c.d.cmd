@@ -0,0 +1 @@
+/usr/bin/cc -Wall -Wextra -O2 -include config.h -D__LINUX__=1 -I/usr/include/libpng16   -Iinclude -Isrc -M src/work.c | sed 's,\(work\.o\) *:,.libtwin.a/src/ .libtwin.a/src/work.c.d: ,' > .libtwin.a/src/work.c.d; cp -rf .libtwin.a/src/work.c.d .libtwin.a/src/work.c.d.p; sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\$//' -e '/^$/ d' -e 's/$/ :/' < .libtwin.a/src/work.c.d >> .libtwin.a/src/work.c.d.p; mv .libtwin.a/src/work.c.d.p .libtwin.a/src/work.c.d
@@ -25,7 +25,6 @@ static void _apps_animation_paint(apps_animation_t *anim)
     if (twin_pixmap_is_animated(anim->pix)) {
         twin_animation_t *a = anim->pix->animation;
         current_frame = twin_animation_get_current_frame(a);
-        twin_animation_advance_frame(a);
     } else {
         current_frame = anim->pix;
     }
@@ -38,14 +37,29 @@ static void _apps_animation_paint(apps_animation_t *anim)
                    TWIN_SOURCE, current_frame->width, current_frame->height);
 }
 
+static twin_time_t _apps_animation_timeout(twin_time_t now, void *closure);
+
+static bool _apps_animation_frame(twin_time_t maybe_unused target,
+                                  void *closure)
+{
+    apps_animation_t *anim = closure;
+    twin_animation_t *a = anim->pix->animation;
+
+    /* Step on the refresh so the new frame shares its composite */
+    twin_animation_advance_frame(a);
+    _twin_widget_queue_paint(&anim->widget);
+    anim->timeout = twin_set_timeout(_apps_animation_timeout,
+                                     twin_animation_get_current_delay(a), anim);
+    return false;
+}
+
 static twin_time_t _apps_animation_timeout(twin_time_t maybe_unused now,
                                            void *closure)
 {
     apps_animation_t *anim = closure;
-    _twin_widget_queue_paint(&anim->widget);
-    twin_animation_t *a = anim->pix->animation;
-    twin_time_t delay = twin_animation_get_current_delay(a);
-    return delay;
+    anim->timeout = NULL;
+    twin_set_frame(_apps_animation_frame, anim);
+    return -1;
 }
 
 static twin_dispatch_result_t _apps_animation_dispatch(twin_widget_t *widget,
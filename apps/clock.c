@@ -199,11 +199,18 @@ static void _apps_clock_paint(apps_clock_t *clock)
                     APPS_CLOCK_SECOND, APPS_CLOCK_SECOND_OUT);
 }
 
-static twin_time_t _apps_clock_timeout(twin_time_t maybe_unused now,
-                                       void *closure)
+static bool _apps_clock_frame(twin_time_t maybe_unused target, void *closure)
 {
     apps_clock_t *clock = closure;
     _twin_widget_queue_paint(&clock->widget);
+    return false;
+}
+
+static twin_time_t _apps_clock_timeout(twin_time_t maybe_unused now,
+                                       void *closure)
+{
+    /* Repaint on the next refresh, together with everything else */
+    twin_set_frame(_apps_clock_frame, closure);
     return _apps_clock_interval();
 }
 
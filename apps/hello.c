@@ -11,8 +11,7 @@
 
 #define maybe_unused __attribute__((unused))
 
-static twin_time_t _apps_hello_timeout(twin_time_t maybe_unused now,
-                                       void *closure)
+static bool _apps_hello_frame(twin_time_t maybe_unused target, void *closure)
 {
     twin_label_t *labelb = closure;
     time_t secs = time(0);
@@ -21,6 +20,13 @@ static twin_time_t _apps_hello_timeout(twin_time_t maybe_unused now,
     *strchr(t, '\n') = '\0';
     twin_label_set(labelb, t, 0xff008000, twin_int_to_fixed(12),
                    TwinStyleOblique);
+    return false;
+}
+
+static twin_time_t _apps_hello_timeout(twin_time_t maybe_unused now,
+                                       void *closure)
+{
+    twin_set_frame(_apps_hello_frame, closure);
     return 1000;
 }
 
@@ -19,8 +19,19 @@ typedef struct {
     twin_widget_t widget;
     twin_pixmap_t **pixes;
     int image_idx;
+    struct _apps_image_load *load;
 } apps_image_t;
 
+/* Rasterizing a TVG file takes long enough to stall input, so do it on a
+ * worker thread and pick up the result on the main loop.
+ */
+typedef struct _apps_image_load {
+    apps_image_t *img;
+    twin_job_t *job;
+    int idx;
+    twin_pixmap_t *pix;
+} apps_image_load_t;
+
 static const char *tvg_files[] = {
     /* https://dev.w3.org/SVG/tools/svgweb/samples/svg-files/ */
     ASSET_PATH "tiger.tvg",
@@ -38,6 +49,13 @@ static const char *tvg_files[] = {
 
 static void _apps_image_paint(apps_image_t *img)
 {
+    if (!img->pixes[img->image_idx]) {
+        /* Still loading */
+        twin_fill(_apps_image_pixmap(img), 0xffffffff, TWIN_SOURCE, 0, 0,
+                  APP_WIDTH, APP_HEIGHT);
+        return;
+    }
+
     twin_operand_t srcop = {
         .source_kind = TWIN_PIXMAP,
         .u.pixmap = img->pixes[img->image_idx],
@@ -63,6 +81,55 @@ static twin_dispatch_result_t _apps_image_dispatch(twin_widget_t *widget,
     return TwinDispatchContinue;
 }
 
+static void _apps_image_load_job(void *closure)
+{
+    apps_image_load_t *load = closure;
+    load->pix = twin_tvg_to_pixmap_scale(tvg_files[load->idx], TWIN_ARGB32,
+                                         APP_WIDTH, APP_HEIGHT);
+}
+
+static void _apps_image_load_done(void *closure, bool cancelled)
+{
+    apps_image_load_t *load = closure;
+    apps_image_t *img = load->img;
+
+    if (img->load == load)
+        img->load = NULL;
+    if (cancelled || !load->pix || img->pixes[load->idx]) {
+        if (load->pix)
+            twin_pixmap_destroy(load->pix);
+    } else {
+        img->pixes[load->idx] = load->pix;
+        if (load->idx == img->image_idx)
+            _twin_widget_queue_paint(&img->widget);
+    }
+    free(load);
+}
+
+static void _apps_image_load(apps_image_t *img, int idx)
+{
+    /* Only the most recently requested image is worth finishing */
+    if (img->load) {
+        if (img->load->idx == idx)
+            return;
+        twin_clear_job(img->load->job);
+        img->load = NULL;
+    }
+
+    apps_image_load_t *load = calloc(1, sizeof(apps_image_load_t));
+    if (!load)
+        return;
+    load->img = img;
+    load->idx = idx;
+    load->job =
+        twin_set_job(_apps_image_load_job, _apps_image_load_done, 0, load);
+    if (!load->job) {
+        free(load);
+        return;
+    }
+    img->load = load;
+}
+
 static void _apps_image_button_signal(maybe_unused twin_button_t *button,
                                       twin_button_signal_t signal,
                                       void *closure)
@@ -73,13 +140,8 @@ static void _apps_image_button_signal(maybe_unused twin_button_t *button,
     apps_image_t *img = closure;
     const int n = sizeof(tvg_files) / sizeof(tvg_files[0]);
     img->image_idx = img->image_idx == n - 1 ? 0 : img->image_idx + 1;
-    if (!img->pixes[img->image_idx]) {
-        twin_pixmap_t *pix = twin_tvg_to_pixmap_scale(
-            tvg_files[img->image_idx], TWIN_ARGB32, APP_WIDTH, APP_HEIGHT);
-        if (!pix)
-            return;
-        img->pixes[img->image_idx] = pix;
-    }
+    if (!img->pixes[img->image_idx])
+        _apps_image_load(img, img->image_idx);
     _twin_widget_queue_paint(&img->widget);
 }
 
@@ -91,9 +153,9 @@ static void _apps_image_init(apps_image_t *img,
     preferred.height = parent->widget.window->screen->height * 3.0 / 4.0;
     _twin_widget_init(&img->widget, parent, 0, preferred, dispatch);
     img->image_idx = 0;
+    img->load = NULL;
     img->pixes = calloc(sizeof(tvg_files), sizeof(twin_pixmap_t *));
-    img->pixes[0] = twin_tvg_to_pixmap_scale(tvg_files[0], TWIN_ARGB32,
-                                             APP_WIDTH, APP_HEIGHT);
+    _apps_image_load(img, 0);
     twin_button_t *button =
         twin_button_create(parent, "Next Image", 0xFF482722, D(10),
                            TwinStyleBold | TwinStyleOblique);
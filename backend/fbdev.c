@@ -6,12 +6,20 @@
 
 #include <fcntl.h>
 #include <linux/fb.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <twin.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "linux_input.h"
 #include "linux_vt.h"
 #include "twin_backend.h"
@@ -22,6 +30,31 @@
 #define SCREEN(x) ((twin_context_t *) x)->screen
 #define PRIV(x) ((twin_fbdev_t *) ((twin_context_t *) x)->priv)
 
+/* Framebuffer pages composed into in turn */
+#if defined(CONFIG_FBDEV_TRIPLE_BUFFER)
+#define FBDEV_PAGES 3
+#elif defined(CONFIG_FBDEV_PAGE_FLIP)
+#define FBDEV_PAGES 2
+#else
+#define FBDEV_PAGES 1
+#endif
+
+/* 565 output optionally goes through the ordered dither */
+#if defined(CONFIG_FBDEV_DITHER_565)
+#define FBDEV_DITHER(convert) convert##_dither
+#else
+#define FBDEV_DITHER(convert) convert
+#endif
+
+/* Each converter turns one span of ARGB32 pixels into the framebuffer
+ * format at 'dest'; 'x' and 'y' locate the span for ordered dithering.
+ */
+typedef void (*twin_fbdev_convert_t)(uint8_t *dest,
+                                     const twin_argb32_t *pixels,
+                                     twin_coord_t width,
+                                     twin_coord_t x,
+                                     twin_coord_t y);
+
 typedef struct {
     twin_screen_t *screen;
 
@@ -40,43 +73,245 @@ typedef struct {
     uint16_t cmap[3][256];
     uint8_t *fb_base;
     size_t fb_len;
+
+    /* Page flipping: 'fb_page' is the back page of the device memory */
+    int fb_pages;
+    int fb_back;
+    bool fb_no_vsync;
+    uint8_t *fb_page;
+    /* Damage of the frames drawn since the back page was, newest first */
+    twin_rect_t fb_history[FBDEV_PAGES];
+    /* Area twin_screen_update composed in the frame being drawn */
+    twin_rect_t fb_drawn;
+
+    /* Converts spans to the framebuffer format */
+    twin_fbdev_convert_t convert;
+
+    /* Spans land at 'fb_draw': the shadow in system memory, if there is
+     * one, or else the back page itself
+     */
+    uint8_t *fb_draw;
+    uint8_t *shadow;
+    size_t shadow_len;
+
+    /* Vertical blank notification, only waited for while frames pend */
+    pthread_t vsync_thread;
+    pthread_mutex_t vsync_lock;
+    pthread_cond_t vsync_cond;
+    bool vsync_armed, vsync_quit;
+    int vsync_fd;
+    twin_file_t *vsync_file;
 } twin_fbdev_t;
 
 /* color conversion */
-#define ARGB32_TO_RGB565_PERLINE(dest, pixels, width)   \
-    do {                                                \
-        for (int i = 0; i < width; i++)                 \
-            dest[i] = ((pixels[i] & 0x00f80000) >> 8) | \
-                      ((pixels[i] & 0x0000fc00) >> 5) | \
-                      ((pixels[i] & 0x000000f8) >> 3);  \
-    } while (0)
-
-/* Requires validation in 24-bit per pixel environments */
-#define ARGB32_TO_RGB888_PERLINE(dest, pixels, width) \
-    do {                                              \
-        for (int i = 0; i < width; i++)               \
-            dest[i] = 0xff000000 | pixels[i];         \
-    } while (0)
-
-#define ARGB32_TO_ARGB32_PERLINE(dest, pixels, width) \
-    memcpy(dest, pixels, width * sizeof(*dest))
-
-#define FBDEV_PUT_SPAN_IMPL(bpp, op)                                     \
-    static void _twin_fbdev_put_span##bpp(                               \
-        twin_coord_t left, twin_coord_t top, twin_coord_t right,         \
-        twin_argb32_t *pixels, void *closure)                            \
-    {                                                                    \
-        uint32_t *dest;                                                  \
-        twin_fbdev_t *tx = PRIV(closure);                                \
-        off_t off = sizeof(*dest) * left + top * tx->fb_fix.line_length; \
-        dest = (uint32_t *) ((uintptr_t) tx->fb_base + off);             \
-        twin_coord_t width = right - left;                               \
-        op(dest, pixels, width);                                         \
+static inline twin_argb32_t twin_fbdev_swap_rb(twin_argb32_t p)
+{
+    return (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+static inline uint16_t twin_fbdev_pack565(twin_argb32_t p)
+{
+    return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+#if defined(__SSE2__)
+static inline __m128i twin_fbdev_swap_rb_x4(__m128i p)
+{
+    return _mm_or_si128(
+        _mm_and_si128(p, _mm_set1_epi32(0xff00ff00)),
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xff)),
+                     _mm_and_si128(_mm_slli_epi32(p, 16),
+                                   _mm_set1_epi32(0xff0000))));
+}
+
+/* Four pixels to 565, biased into the signed range for _mm_packs_epi32 */
+static inline __m128i twin_fbdev_pack565_x4(__m128i p)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    return _mm_sub_epi32(_mm_or_si128(r, _mm_or_si128(g, b)),
+                         _mm_set1_epi32(0x8000));
+}
+#endif
+
+static inline void twin_fbdev_convert565(uint8_t *dest,
+                                         const twin_argb32_t *pixels,
+                                         twin_coord_t width,
+                                         bool bgr)
+{
+    uint16_t *d = (uint16_t *) dest;
+    twin_coord_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 8 <= width; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (pixels + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (pixels + i + 4));
+        if (bgr) {
+            a = twin_fbdev_swap_rb_x4(a);
+            b = twin_fbdev_swap_rb_x4(b);
+        }
+        __m128i v = _mm_packs_epi32(twin_fbdev_pack565_x4(a),
+                                    twin_fbdev_pack565_x4(b));
+        v = _mm_add_epi16(v, _mm_set1_epi16((short) 0x8000));
+        _mm_storeu_si128((__m128i *) (d + i), v);
     }
+#endif
+    for (; i < width; i++)
+        d[i] = twin_fbdev_pack565(bgr ? twin_fbdev_swap_rb(pixels[i])
+                                      : pixels[i]);
+}
 
-FBDEV_PUT_SPAN_IMPL(16, ARGB32_TO_RGB565_PERLINE)
-FBDEV_PUT_SPAN_IMPL(24, ARGB32_TO_RGB888_PERLINE)
-FBDEV_PUT_SPAN_IMPL(32, ARGB32_TO_ARGB32_PERLINE)
+/* 4x4 Bayer matrix, spreading the bits 565 drops over neighbouring pixels */
+static const uint8_t twin_fbdev_bayer[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+static inline void twin_fbdev_convert565_dither(uint8_t *dest,
+                                                const twin_argb32_t *pixels,
+                                                twin_coord_t width,
+                                                twin_coord_t x,
+                                                twin_coord_t y,
+                                                bool bgr)
+{
+    const uint8_t *row = twin_fbdev_bayer[y & 3];
+    uint16_t *d = (uint16_t *) dest;
+
+    for (twin_coord_t i = 0; i < width; i++) {
+        twin_argb32_t p = bgr ? twin_fbdev_swap_rb(pixels[i]) : pixels[i];
+        int t = row[(x + i) & 3];
+        int r = min(((p >> 16) & 0xff) + (t >> 1), 0xffu);
+        int g = min(((p >> 8) & 0xff) + (t >> 2), 0xffu);
+        int b = min((p & 0xff) + (t >> 1), 0xffu);
+        d[i] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+    }
+}
+
+/* Three bytes per pixel; four pixels are packed into three 32-bit words */
+static inline void twin_fbdev_convert888(uint8_t *dest,
+                                         const twin_argb32_t *pixels,
+                                         twin_coord_t width,
+                                         bool bgr)
+{
+    twin_coord_t i = 0;
+
+    for (; i + 4 <= width; i += 4, dest += 12) {
+        twin_argb32_t p0 = pixels[i], p1 = pixels[i + 1];
+        twin_argb32_t p2 = pixels[i + 2], p3 = pixels[i + 3];
+        if (bgr) {
+            p0 = twin_fbdev_swap_rb(p0);
+            p1 = twin_fbdev_swap_rb(p1);
+            p2 = twin_fbdev_swap_rb(p2);
+            p3 = twin_fbdev_swap_rb(p3);
+        }
+        uint32_t w[3] = {
+            (p0 & 0xffffff) | (p1 << 24),
+            ((p1 >> 8) & 0xffff) | (p2 << 16),
+            ((p2 >> 16) & 0xff) | (p3 << 8),
+        };
+        memcpy(dest, w, sizeof(w));
+    }
+    for (; i < width; i++, dest += 3) {
+        twin_argb32_t p = bgr ? twin_fbdev_swap_rb(pixels[i]) : pixels[i];
+        dest[0] = p;
+        dest[1] = p >> 8;
+        dest[2] = p >> 16;
+    }
+}
+
+static inline void twin_fbdev_convert8888(uint8_t *dest,
+                                          const twin_argb32_t *pixels,
+                                          twin_coord_t width,
+                                          bool bgr)
+{
+    uint32_t *d = (uint32_t *) dest;
+    twin_coord_t i = 0;
+
+    if (!bgr) {
+        memcpy(dest, pixels, width * sizeof(*d));
+        return;
+    }
+#if defined(__SSE2__)
+    for (; i + 4 <= width; i += 4)
+        _mm_storeu_si128(
+            (__m128i *) (d + i),
+            twin_fbdev_swap_rb_x4(
+                _mm_loadu_si128((const __m128i *) (pixels + i))));
+#endif
+    for (; i < width; i++)
+        d[i] = twin_fbdev_swap_rb(pixels[i]);
+}
+
+#define FBDEV_CONVERT_IMPL(name, call)                                  \
+    static void _twin_fbdev_convert_##name(                             \
+        uint8_t *dest, const twin_argb32_t *pixels, twin_coord_t width, \
+        twin_coord_t x maybe_unused, twin_coord_t y maybe_unused)       \
+    {                                                                   \
+        call;                                                           \
+    }
+
+FBDEV_CONVERT_IMPL(rgb565, twin_fbdev_convert565(dest, pixels, width, false))
+FBDEV_CONVERT_IMPL(bgr565, twin_fbdev_convert565(dest, pixels, width, true))
+#if defined(CONFIG_FBDEV_DITHER_565)
+FBDEV_CONVERT_IMPL(rgb565_dither,
+                   twin_fbdev_convert565_dither(dest, pixels, width, x, y,
+                                                false))
+FBDEV_CONVERT_IMPL(bgr565_dither,
+                   twin_fbdev_convert565_dither(dest, pixels, width, x, y,
+                                                true))
+#endif
+FBDEV_CONVERT_IMPL(rgb888, twin_fbdev_convert888(dest, pixels, width, false))
+FBDEV_CONVERT_IMPL(bgr888, twin_fbdev_convert888(dest, pixels, width, true))
+FBDEV_CONVERT_IMPL(argb32, twin_fbdev_convert8888(dest, pixels, width, false))
+FBDEV_CONVERT_IMPL(abgr32, twin_fbdev_convert8888(dest, pixels, width, true))
+
+/* Only a shadow in the native format is composited into directly; the
+ * blending reads back what it writes, which device memory is slow at.
+ */
+static twin_argb32_t *_twin_fbdev_get_span(twin_coord_t left,
+                                           twin_coord_t top,
+                                           twin_coord_t right maybe_unused,
+                                           void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+
+    if (!tx->shadow || tx->convert != _twin_fbdev_convert_argb32)
+        return NULL;
+    return (twin_argb32_t *) (tx->fb_draw +
+                              (size_t) top * tx->fb_fix.line_length) +
+           left;
+}
+
+static void _twin_fbdev_put_begin(twin_coord_t left,
+                                  twin_coord_t top,
+                                  twin_coord_t right,
+                                  twin_coord_t bottom,
+                                  void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+
+    tx->fb_drawn = (twin_rect_t) {
+        .left = left, .top = top, .right = right, .bottom = bottom};
+}
+
+static void _twin_fbdev_put_span(twin_coord_t left,
+                                 twin_coord_t top,
+                                 twin_coord_t right,
+                                 twin_argb32_t *pixels,
+                                 void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+    size_t off = (size_t) top * tx->fb_fix.line_length +
+                 (size_t) left * (tx->fb_var.bits_per_pixel / 8);
+
+    /* Rows composited in place are already converted */
+    if ((uint8_t *) pixels == tx->fb_draw + off)
+        return;
+    (*tx->convert)(tx->fb_draw + off, pixels, right - left, left, top);
+}
 
 static void twin_fbdev_get_screen_size(twin_fbdev_t *tx,
                                        int *width,
@@ -88,25 +323,115 @@ static void twin_fbdev_get_screen_size(twin_fbdev_t *tx,
     *height = info.yres;
 }
 
-static inline bool twin_fbdev_is_rgb565(twin_fbdev_t *tx)
+static inline bool twin_fbdev_is_format(twin_fbdev_t *tx,
+                                        uint32_t red,
+                                        uint32_t green,
+                                        uint32_t blue,
+                                        uint32_t red_len,
+                                        uint32_t green_len,
+                                        uint32_t blue_len)
+{
+    return tx->fb_var.red.offset == red && tx->fb_var.red.length == red_len &&
+           tx->fb_var.green.offset == green &&
+           tx->fb_var.green.length == green_len &&
+           tx->fb_var.blue.offset == blue && tx->fb_var.blue.length == blue_len;
+}
+
+static int twin_fbdev_pages(twin_fbdev_t *tx)
+{
+    size_t page = (size_t) tx->fb_fix.line_length * tx->fb_var.yres;
+    int pages = tx->fb_var.yres_virtual / tx->fb_var.yres;
+
+    /* Flipping needs a driver that pans by whole pages */
+    if (!tx->fb_fix.ypanstep || tx->fb_var.yres % tx->fb_fix.ypanstep)
+        return 1;
+    if (pages > FBDEV_PAGES)
+        pages = FBDEV_PAGES;
+    if (page * pages > tx->fb_fix.smem_len)
+        pages = tx->fb_fix.smem_len / page;
+    return pages < 1 ? 1 : pages;
+}
+
+static void twin_fbdev_set_back(twin_fbdev_t *tx, int back)
+{
+    tx->fb_back = back;
+    tx->fb_page = tx->fb_base + (size_t) back * tx->fb_var.yres *
+                                    tx->fb_fix.line_length;
+    tx->fb_draw = tx->shadow ? tx->shadow : tx->fb_page;
+}
+
+static bool twin_fbdev_shadow_init(twin_fbdev_t *tx)
 {
-    return tx->fb_var.red.offset == 11 && tx->fb_var.red.length == 5 &&
-           tx->fb_var.green.offset == 5 && tx->fb_var.green.length == 6 &&
-           tx->fb_var.blue.offset == 0 && tx->fb_var.blue.length == 5;
+#if defined(CONFIG_FBDEV_SHADOW)
+    size_t len = (size_t) tx->fb_fix.line_length * tx->fb_var.yres;
+
+    if (tx->shadow && tx->shadow_len == len)
+        return true;
+    free(tx->shadow);
+    tx->shadow = malloc(len);
+    tx->shadow_len = tx->shadow ? len : 0;
+    if (!tx->shadow) {
+        log_error("Failed to allocate the shadow framebuffer");
+        return false;
+    }
+    return true;
+#else
+    (void) tx;
+    return false;
+#endif
 }
 
-static inline bool twin_fbdev_is_rgb888(twin_fbdev_t *tx)
+/* Device memory is typically uncached or write-combined: fill it with
+ * full-width stores that bypass the cache, and never read it back.
+ */
+static void twin_fbdev_stream(uint8_t *dst, const uint8_t *src, size_t len)
 {
-    return tx->fb_var.red.offset == 16 && tx->fb_var.red.length == 8 &&
-           tx->fb_var.green.offset == 8 && tx->fb_var.green.length == 8 &&
-           tx->fb_var.blue.offset == 0 && tx->fb_var.blue.length == 8;
+#if defined(__SSE2__)
+    while (len && ((uintptr_t) dst & 15)) {
+        *dst++ = *src++;
+        len--;
+    }
+    for (; len >= 64; len -= 64, src += 64, dst += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) src);
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+        _mm_stream_si128((__m128i *) dst, a);
+        _mm_stream_si128((__m128i *) (dst + 16), b);
+        _mm_stream_si128((__m128i *) (dst + 32), c);
+        _mm_stream_si128((__m128i *) (dst + 48), d);
+    }
+    for (; len >= 16; len -= 16, src += 16, dst += 16)
+        _mm_stream_si128((__m128i *) dst,
+                         _mm_loadu_si128((const __m128i *) src));
+#endif
+    memcpy(dst, src, len);
 }
 
-static inline bool twin_fbdev_is_argb32(twin_fbdev_t *tx)
+/* Copy a rectangle of the shadow into the back page */
+static void twin_fbdev_flush(twin_fbdev_t *tx, twin_rect_t r)
 {
-    return tx->fb_var.red.offset == 16 && tx->fb_var.red.length == 8 &&
-           tx->fb_var.green.offset == 8 && tx->fb_var.green.length == 8 &&
-           tx->fb_var.blue.offset == 0 && tx->fb_var.blue.length == 8;
+    size_t bpp = tx->fb_var.bits_per_pixel / 8;
+    size_t stride = tx->fb_fix.line_length;
+
+    if (r.left < 0)
+        r.left = 0;
+    if (r.top < 0)
+        r.top = 0;
+    if (r.right > (twin_coord_t) tx->fb_var.xres)
+        r.right = tx->fb_var.xres;
+    if (r.bottom > (twin_coord_t) tx->fb_var.yres)
+        r.bottom = tx->fb_var.yres;
+    if (r.left >= r.right || r.top >= r.bottom)
+        return;
+
+    size_t off = r.top * stride + r.left * bpp;
+    size_t len = (r.right - r.left) * bpp;
+    for (twin_coord_t y = r.top; y < r.bottom; y++, off += stride)
+        twin_fbdev_stream(tx->fb_page + off, tx->shadow + off, len);
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
 }
 
 static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
@@ -117,12 +442,17 @@ static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
         return false;
     }
 
-    /* Set the virtual screen size to be the same as the physical screen */
+    /* Stack the pages vertically in the virtual screen */
     tx->fb_var.xres_virtual = tx->fb_var.xres;
-    tx->fb_var.yres_virtual = tx->fb_var.yres;
+    tx->fb_var.yres_virtual = tx->fb_var.yres * FBDEV_PAGES;
+    tx->fb_var.xoffset = tx->fb_var.yoffset = 0;
     if (ioctl(tx->fb_fd, FBIOPUT_VSCREENINFO, &tx->fb_var) < 0) {
-        log_error("Failed to set framebuffer mode");
-        return false;
+        /* Not enough video memory for the pages; draw to the screen */
+        tx->fb_var.yres_virtual = tx->fb_var.yres;
+        if (ioctl(tx->fb_fd, FBIOPUT_VSCREENINFO, &tx->fb_var) < 0) {
+            log_error("Failed to set framebuffer mode");
+            return false;
+        }
     }
 
     /* Read changable information of the framebuffer again */
@@ -131,29 +461,41 @@ static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
         return false;
     }
 
-    /* Examine the framebuffer format */
+    /* Examine the framebuffer format and pick its converter */
     switch (tx->fb_var.bits_per_pixel) {
-    case 16: /* RGB565 */
-        if (!twin_fbdev_is_rgb565(tx)) {
+    case 16: /* RGB565 or BGR565 */
+        if (twin_fbdev_is_format(tx, 11, 5, 0, 5, 6, 5)) {
+            tx->convert = FBDEV_DITHER(_twin_fbdev_convert_rgb565);
+        } else if (twin_fbdev_is_format(tx, 0, 5, 11, 5, 6, 5)) {
+            tx->convert = FBDEV_DITHER(_twin_fbdev_convert_bgr565);
+        } else {
             log_error("Invalid framebuffer format for 16 bpp");
             return false;
         }
         break;
-    case 24: /* RGB888 */
-        if (!twin_fbdev_is_rgb888(tx)) {
+    case 24: /* RGB888 or BGR888 */
+        if (twin_fbdev_is_format(tx, 16, 8, 0, 8, 8, 8)) {
+            tx->convert = _twin_fbdev_convert_rgb888;
+        } else if (twin_fbdev_is_format(tx, 0, 8, 16, 8, 8, 8)) {
+            tx->convert = _twin_fbdev_convert_bgr888;
+        } else {
             log_error("Invalid framebuffer format for 24 bpp");
             return false;
         }
         break;
-    case 32: /* ARGB32 */
-        if (!twin_fbdev_is_argb32(tx)) {
+    case 32: /* ARGB32 or ABGR32 */
+        if (twin_fbdev_is_format(tx, 16, 8, 0, 8, 8, 8)) {
+            tx->convert = _twin_fbdev_convert_argb32;
+        } else if (twin_fbdev_is_format(tx, 0, 8, 16, 8, 8, 8)) {
+            tx->convert = _twin_fbdev_convert_abgr32;
+        } else {
             log_error("Invalid framebuffer format for 32 bpp");
             return false;
         }
         break;
     default:
         log_error("Unsupported bits per pixel: %d", tx->fb_var.bits_per_pixel);
-        break;
+        return false;
     }
 
     /* Read unchangable information of the framebuffer */
@@ -175,6 +517,12 @@ static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
         return false;
     }
 
+    /* Start drawing into the page after the one being shown */
+    twin_fbdev_shadow_init(tx);
+    tx->fb_pages = twin_fbdev_pages(tx);
+    memset(tx->fb_history, 0, sizeof(tx->fb_history));
+    twin_fbdev_set_back(tx, tx->fb_pages > 1 ? 1 : 0);
+
     return true;
 }
 
@@ -197,6 +545,125 @@ static bool twin_fbdev_update_damage(void *closure)
     return true;
 }
 
+static void twin_fbdev_wait_vsync(twin_fbdev_t *tx)
+{
+    uint32_t crtc = 0;
+
+    if (tx->fb_no_vsync)
+        return;
+    if (ioctl(tx->fb_fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+        log_info("FBIO_WAITFORVSYNC unsupported, flips may tear");
+        tx->fb_no_vsync = true;
+    }
+}
+
+static bool twin_fbdev_rect_empty(twin_rect_t r)
+{
+    return r.left >= r.right || r.top >= r.bottom;
+}
+
+static void twin_fbdev_rect_union(twin_rect_t *a, twin_rect_t b)
+{
+    if (twin_fbdev_rect_empty(b))
+        return;
+    if (twin_fbdev_rect_empty(*a)) {
+        *a = b;
+        return;
+    }
+    a->left = min(a->left, b.left);
+    a->top = min(a->top, b.top);
+    a->right = max(a->right, b.right);
+    a->bottom = max(a->bottom, b.bottom);
+}
+
+static void twin_fbdev_update(twin_fbdev_t *tx, twin_screen_t *screen)
+{
+    int pages = tx->fb_pages;
+    twin_rect_t damage, stale = {0}, flush;
+    bool disable;
+
+    if (pages == 1 && !tx->shadow) {
+        twin_screen_update(screen);
+        return;
+    }
+
+    pthread_mutex_lock(&screen->damage_lock);
+    damage = screen->damage;
+    disable = screen->disable;
+    pthread_mutex_unlock(&screen->damage_lock);
+    if (disable)
+        return;
+
+    /* The back page has yet to see what the other pages were drawn with.
+     * The shadow is always complete, so that area is only copied out;
+     * without one it has to be composed again.
+     */
+    for (int i = 0; i < pages - 1; i++)
+        twin_fbdev_rect_union(&stale, tx->fb_history[i]);
+    if (!tx->shadow && !twin_fbdev_rect_empty(stale))
+        twin_screen_damage(screen, stale.left, stale.top, stale.right,
+                           stale.bottom);
+
+    /* Drawing threads may add damage until twin_screen_update takes it
+     * over, so only what it reports through put_begin was drawn.
+     */
+    tx->fb_drawn = (twin_rect_t) {0};
+    twin_screen_update(screen);
+    if (twin_fbdev_rect_empty(tx->fb_drawn))
+        return;
+
+    flush = tx->fb_drawn;
+    if (tx->shadow) {
+        twin_fbdev_rect_union(&flush, stale);
+        twin_fbdev_flush(tx, flush);
+    }
+    if (pages == 1)
+        return;
+
+    /* Record what changed in this frame. The stale area composed again
+     * is left out unless late damage makes the two impossible to tell
+     * apart; recording it would carry it from frame to frame.
+     */
+    twin_rect_t expect = damage;
+    twin_fbdev_rect_union(&expect, stale);
+    expect.right = min(expect.right, screen->width);
+    expect.bottom = min(expect.bottom, screen->height);
+    if (tx->shadow || expect.left != tx->fb_drawn.left ||
+        expect.top != tx->fb_drawn.top || expect.right != tx->fb_drawn.right ||
+        expect.bottom != tx->fb_drawn.bottom)
+        damage = tx->fb_drawn;
+    memmove(&tx->fb_history[1], &tx->fb_history[0],
+            (pages - 2) * sizeof(twin_rect_t));
+    tx->fb_history[0] = damage;
+
+    /* Show the page just drawn */
+    tx->fb_var.yoffset = tx->fb_back * tx->fb_var.yres;
+    if (ioctl(tx->fb_fd, FBIOPAN_DISPLAY, &tx->fb_var) < 0) {
+        log_error("Failed to pan the framebuffer, page flipping disabled");
+        tx->fb_pages = 1;
+        twin_fbdev_set_back(tx, 0);
+        if (tx->shadow)
+            twin_fbdev_flush(tx, (twin_rect_t) {.right = screen->width,
+                                                .bottom = screen->height});
+        else
+            twin_screen_damage(screen, 0, 0, screen->width, screen->height);
+        tx->fb_var.yoffset = 0;
+        ioctl(tx->fb_fd, FBIOPAN_DISPLAY, &tx->fb_var);
+        return;
+    }
+
+    /* With two pages the next back page is the one just panned away from,
+     * which stays on screen until the pan takes effect at vertical blank.
+     */
+#if defined(CONFIG_FBDEV_WAIT_VSYNC)
+    twin_fbdev_wait_vsync(tx);
+#else
+    if (pages == 2)
+        twin_fbdev_wait_vsync(tx);
+#endif
+    twin_fbdev_set_back(tx, (tx->fb_back + 1) % pages);
+}
+
 static bool twin_fbdev_work(void *closure)
 {
     twin_fbdev_t *tx = PRIV(closure);
@@ -218,9 +685,104 @@ static bool twin_fbdev_work(void *closure)
     }
 
     if (!tx->vt_active && twin_screen_damaged(screen))
-        twin_screen_update(screen);
+        twin_fbdev_update(tx, screen);
+
+    return true;
+}
+
+static void *twin_fbdev_vsync_thread(void *arg)
+{
+    twin_fbdev_t *tx = arg;
+    uint32_t crtc = 0;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&tx->vsync_lock);
+    for (;;) {
+        while (!tx->vsync_armed && !tx->vsync_quit)
+            pthread_cond_wait(&tx->vsync_cond, &tx->vsync_lock);
+        if (tx->vsync_quit)
+            break;
+        pthread_mutex_unlock(&tx->vsync_lock);
+
+        if (ioctl(tx->fb_fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+            log_info("FBIO_WAITFORVSYNC unsupported, frames follow a timer");
+            return NULL;
+        }
+        if (write(tx->vsync_fd, &one, sizeof(one)) < 0)
+            log_error("Failed to report vertical blank");
+
+        pthread_mutex_lock(&tx->vsync_lock);
+    }
+    pthread_mutex_unlock(&tx->vsync_lock);
+    return NULL;
+}
+
+static void twin_fbdev_vsync_arm(bool armed, void *closure)
+{
+    twin_fbdev_t *tx = closure;
+
+    pthread_mutex_lock(&tx->vsync_lock);
+    tx->vsync_armed = armed;
+    pthread_cond_signal(&tx->vsync_cond);
+    pthread_mutex_unlock(&tx->vsync_lock);
+}
 
+static bool twin_fbdev_vsync(int file,
+                             twin_file_op_t ops maybe_unused,
+                             void *closure maybe_unused)
+{
+    uint64_t count;
+
+    if (read(file, &count, sizeof(count)) > 0)
+        _twin_frame_vblank(_twin_now_nsec());
+    return true;
+}
+
+static bool twin_fbdev_vsync_init(twin_fbdev_t *tx)
+{
+    tx->vsync_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tx->vsync_fd < 0)
+        return false;
+
+    tx->vsync_file =
+        twin_set_file(twin_fbdev_vsync, tx->vsync_fd, TWIN_READ, tx);
+    if (!tx->vsync_file)
+        goto bail_fd;
+
+    pthread_mutex_init(&tx->vsync_lock, NULL);
+    pthread_cond_init(&tx->vsync_cond, NULL);
+    if (pthread_create(&tx->vsync_thread, NULL, twin_fbdev_vsync_thread, tx))
+        goto bail_file;
+
+    _twin_frame_set_vblank(twin_fbdev_vsync_arm, tx);
     return true;
+
+bail_file:
+    pthread_cond_destroy(&tx->vsync_cond);
+    pthread_mutex_destroy(&tx->vsync_lock);
+    twin_clear_file(tx->vsync_file);
+bail_fd:
+    close(tx->vsync_fd);
+    tx->vsync_fd = -1;
+    return false;
+}
+
+static void twin_fbdev_vsync_exit(twin_fbdev_t *tx)
+{
+    if (tx->vsync_fd < 0)
+        return;
+
+    _twin_frame_set_vblank(NULL, NULL);
+    pthread_mutex_lock(&tx->vsync_lock);
+    tx->vsync_quit = true;
+    pthread_cond_signal(&tx->vsync_cond);
+    pthread_mutex_unlock(&tx->vsync_lock);
+    pthread_join(tx->vsync_thread, NULL);
+
+    pthread_cond_destroy(&tx->vsync_cond);
+    pthread_mutex_destroy(&tx->vsync_lock);
+    twin_clear_file(tx->vsync_file);
+    close(tx->vsync_fd);
 }
 
 twin_context_t *twin_fbdev_init(int width, int height)
@@ -268,15 +830,11 @@ twin_context_t *twin_fbdev_init(int width, int height)
         return;
     }
 
-    const twin_put_span_t fbdev_put_spans[] = {
-        _twin_fbdev_put_span16,
-        _twin_fbdev_put_span24,
-        _twin_fbdev_put_span32,
-    };
     /* Create TWIN screen */
-    ctx->screen = twin_screen_create(
-        width, height, NULL, fbdev_put_spans[tx->fb_var.bits_per_pixel / 8 - 2],
-        ctx);
+    ctx->screen =
+        twin_screen_create(width, height, _twin_fbdev_put_begin,
+                           _twin_fbdev_put_span, ctx);
+    twin_screen_register_get_span(ctx->screen, _twin_fbdev_get_span);
 
     /* Create Linux input system object */
     tx->input = twin_linux_input_create(ctx->screen);
@@ -288,6 +846,10 @@ twin_context_t *twin_fbdev_init(int width, int height)
     /* Setup file handler and work functions */
     twin_set_work(twin_fbdev_work, TWIN_WORK_REDISPLAY, ctx);
 
+    /* Drive the frame clock from vertical blank when the driver allows */
+    if (!twin_fbdev_vsync_init(tx))
+        log_info("No vertical blank notification, frames follow a timer");
+
     /* Register a callback function to handle damaged rendering */
     twin_screen_register_damaged(ctx->screen, twin_fbdev_update_damage, ctx);
 
@@ -319,9 +881,16 @@ static void twin_fbdev_exit(twin_context_t *ctx)
         return;
 
     twin_fbdev_t *tx = PRIV(ctx);
+    twin_fbdev_vsync_exit(tx);
+    if (tx->fb_var.yoffset) {
+        /* Hand the console back its first page */
+        tx->fb_var.yoffset = 0;
+        ioctl(tx->fb_fd, FBIOPAN_DISPLAY, &tx->fb_var);
+    }
     twin_vt_mode(tx->vt_fd, KD_TEXT);
     munmap(tx->fb_base, tx->fb_len);
     twin_linux_input_destroy(tx->input);
+    free(tx->shadow);
     close(tx->vt_fd);
     close(tx->fb_fd);
     free(ctx->priv);
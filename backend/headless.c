@@ -0,0 +1,334 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* memfd_create() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <twin.h>
+
+#include "twin_backend.h"
+#include "twin_private.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * The headless backend composites into memory that nothing displays, which
+ * makes it a hardware-free target for measuring twin_screen_update(). By
+ * default frames are composited as soon as they are damaged and animations
+ * advance as fast as they can; a simulated refresh rate paces both instead.
+ */
+
+#define MADO_HEADLESS_RATE "MADO_HEADLESS_RATE"
+#define MADO_HEADLESS_FRAMES "MADO_HEADLESS_FRAMES"
+#define MADO_HEADLESS_DUMP "MADO_HEADLESS_DUMP"
+#define MADO_HEADLESS_TIMING "MADO_HEADLESS_TIMING"
+
+#define SCREEN(x) ((twin_context_t *) x)->screen
+#define PRIV(x) ((twin_headless_t *) ((twin_context_t *) x)->priv)
+
+typedef struct {
+    twin_argb32_t *pixels;
+    size_t size;
+    bool mapped;
+    int width, height;
+
+    /* Refresh interval in nanoseconds, zero to run unpaced */
+    twin_nsec_t interval;
+    twin_nsec_t next_vblank;
+    twin_timeout_t *vblank;
+    bool armed;
+
+    /* Frames to composite before leaving the main loop, zero for no limit */
+    unsigned long limit;
+    const char *dump;
+    bool timing;
+
+    unsigned long frames;
+    twin_nsec_t total, min, max;
+    twin_nsec_t started;
+} twin_headless_t;
+
+static twin_argb32_t *_twin_headless_get_span(twin_coord_t left,
+                                              twin_coord_t top,
+                                              twin_coord_t right maybe_unused,
+                                              void *closure)
+{
+    twin_headless_t *tx = PRIV(closure);
+    return tx->pixels + top * tx->width + left;
+}
+
+static void _twin_headless_put_begin(twin_coord_t left maybe_unused,
+                                     twin_coord_t top maybe_unused,
+                                     twin_coord_t right maybe_unused,
+                                     twin_coord_t bottom maybe_unused,
+                                     void *closure maybe_unused)
+{
+}
+
+static void _twin_headless_put_span(twin_coord_t left,
+                                    twin_coord_t top,
+                                    twin_coord_t right,
+                                    twin_argb32_t *pixels,
+                                    void *closure)
+{
+    twin_argb32_t *dest = _twin_headless_get_span(left, top, right, closure);
+
+    /* Rows composited in place need no copy */
+    if (pixels != dest)
+        memcpy(dest, pixels, (right - left) * sizeof(*dest));
+}
+
+/*
+ * Write the whole screen as a binary PPM. The name is the dump prefix, which
+ * may be a directory ending in '/', followed by the frame number.
+ */
+static void _twin_headless_dump(twin_headless_t *tx)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%06lu.ppm", tx->dump, tx->frames);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        log_error("Failed to open %s", path);
+        tx->dump = NULL;
+        return;
+    }
+
+    uint8_t *row = malloc(tx->width * 3);
+    if (!row) {
+        fclose(fp);
+        return;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", tx->width, tx->height);
+    for (int y = 0; y < tx->height; y++) {
+        const twin_argb32_t *src = tx->pixels + y * tx->width;
+        for (int x = 0; x < tx->width; x++) {
+            row[x * 3 + 0] = src[x] >> 16;
+            row[x * 3 + 1] = src[x] >> 8;
+            row[x * 3 + 2] = src[x];
+        }
+        fwrite(row, 3, tx->width, fp);
+    }
+    free(row);
+    fclose(fp);
+}
+
+static void _twin_headless_update(twin_context_t *ctx)
+{
+    twin_screen_t *screen = SCREEN(ctx);
+    twin_headless_t *tx = PRIV(ctx);
+
+    if (!twin_screen_damaged(screen))
+        return;
+
+    pthread_mutex_lock(&screen->damage_lock);
+    twin_rect_t damage = screen->damage;
+    pthread_mutex_unlock(&screen->damage_lock);
+
+    twin_nsec_t start = _twin_now_nsec();
+    twin_screen_update(screen);
+    twin_nsec_t elapsed = _twin_now_nsec() - start;
+
+    tx->frames++;
+    tx->total += elapsed;
+    if (tx->frames == 1 || elapsed < tx->min)
+        tx->min = elapsed;
+    if (elapsed > tx->max)
+        tx->max = elapsed;
+
+    if (tx->timing)
+        printf("frame %lu: %lld ns, %dx%d at %d,%d\n", tx->frames,
+               (long long) elapsed, damage.right - damage.left,
+               damage.bottom - damage.top, damage.left, damage.top);
+    if (tx->dump)
+        _twin_headless_dump(tx);
+}
+
+static bool _twin_headless_work(void *closure)
+{
+    /* A paced screen is only composited on the simulated refresh */
+    if (!PRIV(closure)->interval)
+        _twin_headless_update(closure);
+    return true;
+}
+
+static twin_time_t _twin_headless_vblank(twin_time_t now maybe_unused,
+                                         void *closure)
+{
+    twin_headless_t *tx = PRIV(closure);
+    twin_nsec_t t = _twin_now_nsec();
+
+    _twin_headless_update(closure);
+    _twin_frame_vblank(t);
+
+    /* Keep to the refresh grid even when a pass runs late */
+    do
+        tx->next_vblank += tx->interval;
+    while (tx->next_vblank <= t);
+    return (twin_time_t) ((tx->next_vblank - t + 999999) / 1000000);
+}
+
+static void _twin_headless_arm(bool armed, void *closure)
+{
+    PRIV(closure)->armed = armed;
+}
+
+static bool _twin_headless_alloc(twin_headless_t *tx)
+{
+    tx->size = (size_t) tx->width * tx->height * sizeof(twin_argb32_t);
+
+#if defined(__linux__)
+    /* A memfd keeps the frame shareable with an outside observer */
+    int fd = memfd_create("twin-headless", MFD_CLOEXEC);
+    if (fd >= 0) {
+        if (ftruncate(fd, tx->size) == 0) {
+            void *p = mmap(NULL, tx->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+            if (p != MAP_FAILED) {
+                tx->pixels = p;
+                tx->mapped = true;
+            }
+        }
+        close(fd);
+        if (tx->mapped)
+            return true;
+    }
+#endif
+
+    tx->pixels = calloc(1, tx->size);
+    return tx->pixels != NULL;
+}
+
+static void _twin_headless_free(twin_headless_t *tx)
+{
+#if defined(__linux__)
+    if (tx->mapped) {
+        munmap(tx->pixels, tx->size);
+        return;
+    }
+#endif
+    free(tx->pixels);
+}
+
+twin_context_t *twin_headless_init(int width, int height)
+{
+    twin_context_t *ctx = calloc(1, sizeof(twin_context_t));
+    if (!ctx)
+        return NULL;
+    ctx->priv = calloc(1, sizeof(twin_headless_t));
+    if (!ctx->priv) {
+        free(ctx);
+        return NULL;
+    }
+
+    twin_headless_t *tx = ctx->priv;
+    tx->width = width;
+    tx->height = height;
+    if (!_twin_headless_alloc(tx)) {
+        log_error("Failed to allocate the headless framebuffer");
+        goto bail_priv;
+    }
+
+    const char *env = getenv(MADO_HEADLESS_RATE);
+    int rate = env ? atoi(env) : 0;
+    if (rate > 0)
+        tx->interval = 1000000000LL / rate;
+    env = getenv(MADO_HEADLESS_FRAMES);
+    tx->limit = env ? strtoul(env, NULL, 10) : 0;
+    tx->dump = getenv(MADO_HEADLESS_DUMP);
+    env = getenv(MADO_HEADLESS_TIMING);
+    tx->timing = env && atoi(env) != 0;
+
+    if (rate > 0)
+        log_info("Headless %dx%d at a simulated %d Hz", width, height, rate);
+    else
+        log_info("Headless %dx%d, unpaced", width, height);
+
+    ctx->screen = twin_screen_create(width, height, _twin_headless_put_begin,
+                                     _twin_headless_put_span, ctx);
+    if (!ctx->screen)
+        goto bail_pixels;
+    twin_screen_register_get_span(ctx->screen, _twin_headless_get_span);
+
+    twin_set_work(_twin_headless_work, TWIN_WORK_REDISPLAY, ctx);
+    _twin_frame_set_vblank(_twin_headless_arm, ctx);
+    if (tx->interval) {
+        tx->next_vblank = _twin_now_nsec();
+        tx->vblank = twin_set_timeout(_twin_headless_vblank, 0, ctx);
+    }
+    tx->started = _twin_now_nsec();
+
+    return ctx;
+
+bail_pixels:
+    _twin_headless_free(tx);
+bail_priv:
+    free(ctx->priv);
+    free(ctx);
+    return NULL;
+}
+
+static void twin_headless_configure(twin_context_t *ctx)
+{
+    twin_headless_t *tx = PRIV(ctx);
+    twin_screen_resize(ctx->screen, tx->width, tx->height);
+}
+
+static bool twin_headless_poll(twin_context_t *ctx)
+{
+    twin_headless_t *tx = PRIV(ctx);
+
+    if (tx->limit && tx->frames >= tx->limit)
+        return false;
+
+    /* Unpaced, every pass is a refresh while anything is animating */
+    if (!tx->interval && tx->armed) {
+        _twin_frame_vblank(_twin_now_nsec());
+        return true;
+    }
+    if (!tx->interval && twin_screen_damaged(SCREEN(ctx)))
+        return true;
+
+    _twin_run_file(_twin_work_pending() ? 0 : _twin_timeout_deadline());
+    return true;
+}
+
+static void twin_headless_exit(twin_context_t *ctx)
+{
+    if (!ctx)
+        return;
+
+    twin_headless_t *tx = PRIV(ctx);
+    if (tx->frames) {
+        twin_nsec_t wall = _twin_now_nsec() - tx->started;
+        log_info("Headless: %lu frames in %.3f s, update min %.3f ms, "
+                 "avg %.3f ms, max %.3f ms",
+                 tx->frames, wall / 1e9, tx->min / 1e6,
+                 tx->total / 1e6 / tx->frames, tx->max / 1e6);
+    }
+
+    _twin_frame_set_vblank(NULL, NULL);
+    if (tx->vblank)
+        twin_clear_timeout(tx->vblank);
+    _twin_headless_free(tx);
+    free(ctx->priv);
+    free(ctx);
+}
+
+/* Register the headless backend */
+
+const twin_backend_t g_twin_backend = {
+    .init = twin_headless_init,
+    .configure = twin_headless_configure,
+    .poll = twin_headless_poll,
+    .exit = twin_headless_exit,
+};
@@ -4,16 +4,23 @@
  * All rights reserved.
  */
 
+#include <errno.h>
 #include <fcntl.h>
-#include <libudev.h>
 #include <linux/input.h>
 #include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <twin.h>
 #include <unistd.h>
 
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+#include <sys/inotify.h>
+#else
+#include <libudev.h>
+#endif
+
 #include "linux_input.h"
 #include "twin_private.h"
 
@@ -22,9 +29,47 @@
 #define UDEV_RESERVED_CNT 1
 #define UDEV_EVDEV_FD_CNT (EVDEV_CNT_MAX + UDEV_RESERVED_CNT)
 
+/* Button transitions kept per input frame before SYN_REPORT flushes them */
+#define EVDEV_KEYS_MAX 8
+
+/* Multi-touch slots tracked per device */
+#define EVDEV_SLOTS_MAX TWIN_TOUCH_MAX
+
+struct evdev_slot {
+    /* Tracking id of the contact, -1 while the slot is empty */
+    int id;
+    /* Tracking id last delivered, to tell new contacts from moved ones */
+    int sent_id;
+    /* Touch id the contact is reported with, -1 if none was free */
+    int touch;
+    int x, y;
+    bool moved;
+};
+
 struct evdev_info {
     int idx;
     int fd;
+
+    /* Axis and button changes gathered since the last SYN_REPORT */
+    int dx, dy;
+    int abs_x, abs_y;
+    bool abs_x_set, abs_y_set;
+    int keys[EVDEV_KEYS_MAX];
+    int key_cnt;
+
+    /* Events were lost; discard until SYN_REPORT, then re-read state */
+    bool dropped;
+
+    /* Multi-touch (protocol B) state; the primary contact drives the pointer */
+    bool mt;
+    int slot;
+    int primary;
+    struct input_absinfo mt_x, mt_y;
+    struct evdev_slot slots[EVDEV_SLOTS_MAX];
+
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+    twin_file_t *file;
+#endif
 };
 
 typedef struct {
@@ -36,6 +81,12 @@ typedef struct {
     int fd;
     int btns;
     int x, y;
+    /* Touch ids held by contacts; every device draws from the same set */
+    bool touch_used[TWIN_TOUCH_MAX];
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+    /* inotify watch on /dev/input, registered with the main loop */
+    twin_file_t *hotplug;
+#endif
 } twin_linux_input_t;
 
 static void check_mouse_bounds(twin_linux_input_t *tm)
@@ -50,65 +101,529 @@ static void check_mouse_bounds(twin_linux_input_t *tm)
         tm->y = tm->screen->height;
 }
 
-static void twin_linux_input_events(struct input_event *ev,
-                                    twin_linux_input_t *tm)
+static void twin_linux_input_deliver(twin_linux_input_t *tm,
+                                     twin_event_t *tev)
 {
-    /* TODO: twin_screen_dispatch() should be protect by mutex_lock, but the
-     * counterpart piece of code with mutex is not yet sure */
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+    /* Already on the main loop, deliver within this cycle */
+    twin_screen_dispatch(tm->screen, tev);
+#else
+    /* Events are handed over to the main loop, which owns the screen */
+    (void) tm;
+    twin_event_enqueue(tev);
+#endif
+}
 
+static void twin_linux_input_send(twin_linux_input_t *tm,
+                                  twin_event_kind_t kind)
+{
     twin_event_t tev;
 
+    tev.kind = kind;
+    tev.u.pointer.screen_x = tm->x;
+    tev.u.pointer.screen_y = tm->y;
+    tev.u.pointer.button = tm->btns;
+    twin_linux_input_deliver(tm, &tev);
+}
+
+static void twin_linux_input_touch(twin_linux_input_t *tm,
+                                   twin_event_kind_t kind,
+                                   int id,
+                                   int x,
+                                   int y)
+{
+    twin_event_t tev;
+
+    tev.kind = kind;
+    tev.u.touch.screen_x = x;
+    tev.u.touch.screen_y = y;
+    tev.u.touch.id = id;
+    twin_linux_input_deliver(tm, &tev);
+}
+
+/* Map a raw multi-touch axis value onto [0, size) */
+static int twin_linux_input_scale(int value,
+                                  const struct input_absinfo *abs,
+                                  int size)
+{
+    if (abs->maximum <= abs->minimum)
+        return value;
+    return (int) ((int64_t) (value - abs->minimum) * (size - 1) /
+                  (abs->maximum - abs->minimum));
+}
+
+/* Read every slot from the kernel, on open and after dropped events */
+static void twin_linux_input_mt_resync(struct evdev_info *evdev)
+{
+    static const unsigned codes[] = {
+        ABS_MT_TRACKING_ID,
+        ABS_MT_POSITION_X,
+        ABS_MT_POSITION_Y,
+    };
+    struct {
+        __u32 code;
+        __s32 values[EVDEV_SLOTS_MAX];
+    } req;
+    struct input_absinfo abs;
+
+    if (ioctl(evdev->fd, EVIOCGABS(ABS_MT_SLOT), &abs) == 0)
+        evdev->slot = abs.value;
+
+    for (size_t c = 0; c < sizeof(codes) / sizeof(codes[0]); c++) {
+        req.code = codes[c];
+        if (ioctl(evdev->fd, EVIOCGMTSLOTS(sizeof(req)), &req) < 0)
+            return;
+        for (int i = 0; i < EVDEV_SLOTS_MAX; i++) {
+            struct evdev_slot *s = &evdev->slots[i];
+            if (codes[c] == ABS_MT_TRACKING_ID)
+                s->id = req.values[i];
+            else if (codes[c] == ABS_MT_POSITION_X)
+                s->x = req.values[i];
+            else
+                s->y = req.values[i];
+            s->moved = true;
+        }
+    }
+}
+
+/* Called once a device is opened to find out whether it reports contacts */
+static void twin_linux_input_probe(struct evdev_info *evdev)
+{
+    const size_t bits = 8 * sizeof(unsigned long);
+    unsigned long abs[ABS_CNT / (8 * sizeof(unsigned long)) + 1] = {0};
+
+    evdev->slot = 0;
+    evdev->primary = -1;
+    for (int i = 0; i < EVDEV_SLOTS_MAX; i++)
+        evdev->slots[i].id = evdev->slots[i].sent_id =
+            evdev->slots[i].touch = -1;
+
+    if (ioctl(evdev->fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs) < 0)
+        return;
+    if (!(abs[ABS_MT_SLOT / bits] & (1UL << (ABS_MT_SLOT % bits))))
+        return;
+    if (ioctl(evdev->fd, EVIOCGABS(ABS_MT_POSITION_X), &evdev->mt_x) < 0 ||
+        ioctl(evdev->fd, EVIOCGABS(ABS_MT_POSITION_Y), &evdev->mt_y) < 0)
+        return;
+
+    evdev->mt = true;
+    twin_linux_input_mt_resync(evdev);
+}
+
+static void twin_linux_input_mt(struct evdev_info *evdev,
+                                const struct input_event *ev)
+{
+    if (ev->code == ABS_MT_SLOT) {
+        evdev->slot = ev->value;
+        return;
+    }
+    if (evdev->slot < 0 || evdev->slot >= EVDEV_SLOTS_MAX)
+        return;
+
+    struct evdev_slot *s = &evdev->slots[evdev->slot];
+    switch (ev->code) {
+    case ABS_MT_TRACKING_ID:
+        s->id = ev->value;
+        break;
+    case ABS_MT_POSITION_X:
+        s->x = ev->value;
+        s->moved = true;
+        break;
+    case ABS_MT_POSITION_Y:
+        s->y = ev->value;
+        s->moved = true;
+        break;
+    }
+}
+
+/* Deliver what every contact did during the frame, one event per contact */
+static void twin_linux_input_mt_flush(twin_linux_input_t *tm,
+                                      struct evdev_info *evdev)
+{
+    for (int i = 0; i < EVDEV_SLOTS_MAX; i++) {
+        struct evdev_slot *s = &evdev->slots[i];
+        int x = twin_linux_input_scale(s->x, &evdev->mt_x, tm->screen->width);
+        int y = twin_linux_input_scale(s->y, &evdev->mt_y, tm->screen->height);
+
+        /* The slot was emptied or handed over to a new contact */
+        if (s->sent_id >= 0 && s->sent_id != s->id) {
+            if (s->touch >= 0) {
+                twin_linux_input_touch(tm, TwinEventTouchUp, s->touch, x, y);
+                tm->touch_used[s->touch] = false;
+                s->touch = -1;
+            }
+            if (evdev->primary == i) {
+                evdev->primary = -1;
+                tm->btns = 0;
+                twin_linux_input_send(tm, TwinEventButtonUp);
+            }
+        }
+
+        if (s->id >= 0 && s->sent_id != s->id) {
+            for (int t = 0; t < TWIN_TOUCH_MAX && s->touch < 0; t++) {
+                if (!tm->touch_used[t]) {
+                    tm->touch_used[t] = true;
+                    s->touch = t;
+                }
+            }
+            if (s->touch >= 0)
+                twin_linux_input_touch(tm, TwinEventTouchDown, s->touch, x,
+                                       y);
+
+            /* The first contact down acts as the left button */
+            if (evdev->primary < 0 && !tm->btns) {
+                evdev->primary = i;
+                if (tm->x != x || tm->y != y) {
+                    tm->x = x;
+                    tm->y = y;
+                    twin_linux_input_send(tm, TwinEventMotion);
+                }
+                tm->btns = 1;
+                twin_linux_input_send(tm, TwinEventButtonDown);
+            }
+        } else if (s->id >= 0 && s->moved) {
+            if (s->touch >= 0)
+                twin_linux_input_touch(tm, TwinEventTouchMotion, s->touch, x,
+                                       y);
+            if (evdev->primary == i && (tm->x != x || tm->y != y)) {
+                tm->x = x;
+                tm->y = y;
+                twin_linux_input_send(tm, TwinEventMotion);
+            }
+        }
+
+        s->sent_id = s->id;
+        s->moved = false;
+    }
+}
+
+/* Lift every contact of a device going away, freeing their touch ids */
+static void twin_linux_input_mt_lift(twin_linux_input_t *tm,
+                                     struct evdev_info *evdev)
+{
+    if (!evdev->mt)
+        return;
+    for (int i = 0; i < EVDEV_SLOTS_MAX; i++)
+        evdev->slots[i].id = -1;
+    twin_linux_input_mt_flush(tm, evdev);
+}
+
+static void twin_linux_input_reset(struct evdev_info *evdev)
+{
+    evdev->dx = evdev->dy = 0;
+    evdev->abs_x_set = evdev->abs_y_set = false;
+    evdev->key_cnt = 0;
+}
+
+/* Re-read the device state after the kernel dropped events */
+static void twin_linux_input_resync(twin_linux_input_t *tm,
+                                    struct evdev_info *evdev)
+{
+    struct input_absinfo abs;
+    unsigned long keys[KEY_CNT / (8 * sizeof(unsigned long)) + 1] = {0};
+
+    twin_linux_input_reset(evdev);
+    if (evdev->mt) {
+        twin_linux_input_mt_resync(evdev);
+    } else if (ioctl(evdev->fd, EVIOCGABS(ABS_X), &abs) == 0) {
+        evdev->abs_x = abs.value;
+        evdev->abs_x_set = true;
+    }
+    if (!evdev->mt && ioctl(evdev->fd, EVIOCGABS(ABS_Y), &abs) == 0) {
+        evdev->abs_y = abs.value;
+        evdev->abs_y_set = true;
+    }
+    if (ioctl(evdev->fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+        const size_t bits = 8 * sizeof(unsigned long);
+        int down = !!(keys[BTN_LEFT / bits] & (1UL << (BTN_LEFT % bits)));
+        if (down != tm->btns)
+            evdev->keys[evdev->key_cnt++] = down;
+    }
+}
+
+static void twin_linux_input_flush(twin_linux_input_t *tm,
+                                   struct evdev_info *evdev)
+{
+    if (evdev->mt)
+        twin_linux_input_mt_flush(tm, evdev);
+
+    int x = tm->x, y = tm->y;
+
+    /* One motion per input frame, at the position the hardware reported */
+    tm->x += evdev->dx;
+    tm->y += evdev->dy;
+    if (evdev->abs_x_set)
+        tm->x = evdev->abs_x;
+    if (evdev->abs_y_set)
+        tm->y = evdev->abs_y;
+    check_mouse_bounds(tm);
+    if (tm->x != x || tm->y != y)
+        twin_linux_input_send(tm, TwinEventMotion);
+
+    /* Then every button transition of the frame, in order */
+    for (int i = 0; i < evdev->key_cnt; i++) {
+        tm->btns = evdev->keys[i];
+        twin_linux_input_send(
+            tm, tm->btns ? TwinEventButtonDown : TwinEventButtonUp);
+    }
+
+    twin_linux_input_reset(evdev);
+}
+
+static void twin_linux_input_events(struct input_event *ev,
+                                    twin_linux_input_t *tm,
+                                    struct evdev_info *evdev)
+{
+    if (ev->type == EV_SYN) {
+        if (ev->code == SYN_DROPPED) {
+            evdev->dropped = true;
+            twin_linux_input_reset(evdev);
+        } else if (ev->code == SYN_REPORT) {
+            if (evdev->dropped) {
+                evdev->dropped = false;
+                twin_linux_input_resync(tm, evdev);
+            }
+            twin_linux_input_flush(tm, evdev);
+        }
+        return;
+    }
+
+    if (evdev->dropped)
+        return;
+
     switch (ev->type) {
     case EV_REL:
-        if (ev->code == REL_X) {
-            tm->x += ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
-        } else if (ev->code == REL_Y) {
-            tm->y += ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
-        }
+        if (ev->code == REL_X)
+            evdev->dx += ev->value;
+        else if (ev->code == REL_Y)
+            evdev->dy += ev->value;
         break;
     case EV_ABS:
-        if (ev->code == ABS_X) {
-            tm->x = ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+        /* Touch panels also report the primary contact on ABS_X/ABS_Y */
+        if (evdev->mt) {
+            twin_linux_input_mt(evdev, ev);
+        } else if (ev->code == ABS_X) {
+            evdev->abs_x = ev->value;
+            evdev->abs_x_set = true;
         } else if (ev->code == ABS_Y) {
-            tm->y = ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            evdev->abs_y = ev->value;
+            evdev->abs_y_set = true;
         }
         break;
     case EV_KEY:
         if (ev->code == BTN_LEFT) {
-            tm->btns = ev->value > 0 ? 1 : 0;
-            tev.kind = tm->btns ? TwinEventButtonDown : TwinEventButtonUp;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            /* Keep room for the last transition of a very busy frame */
+            if (evdev->key_cnt == EVDEV_KEYS_MAX)
+                evdev->key_cnt--;
+            evdev->keys[evdev->key_cnt++] = ev->value > 0 ? 1 : 0;
         }
+        break;
     }
 }
 
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+static bool twin_linux_evdev_read(int file, twin_file_op_t ops, void *closure);
+#endif
+
+/* Lift the contacts of a device and stop watching it */
+static void twin_linux_evdev_close(twin_linux_input_t *tm,
+                                   struct evdev_info *evdev)
+{
+    twin_linux_input_mt_lift(tm, evdev);
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+    twin_clear_file(evdev->file);
+#endif
+    close(evdev->fd);
+}
+
+static void twin_linux_edev_open(twin_linux_input_t *tm)
+{
+    /* New event device list */
+    struct evdev_info evdevs[EVDEV_CNT_MAX];
+    int new_evdev_cnt = 0;
+    memset(evdevs, 0, sizeof(evdevs));
+
+    /* Open all event devices */
+    char evdev_name[EVDEV_NAME_SIZE_MAX] = {0};
+    for (int i = 0; i < EVDEV_CNT_MAX; i++) {
+        /* Check if the file exists */
+        snprintf(evdev_name, EVDEV_NAME_SIZE_MAX, "/dev/input/event%d", i);
+        if (access(evdev_name, F_OK) != 0)
+            continue;
+
+        /* Match device with the old device list  */
+        bool opened = false;
+        for (size_t j = 0; j < tm->evdev_cnt; j++) {
+            /* Keep the fd and pending state if already on the list */
+            if (tm->evdevs[j].idx == i) {
+                evdevs[new_evdev_cnt] = tm->evdevs[j];
+                tm->evdevs[j].fd = -1;
+                new_evdev_cnt++;
+                opened = true;
+                break;
+            }
+        }
+        if (opened)
+            continue;
+
+        /* Open the file if it is not on the list */
+        int fd = open(evdev_name, O_RDWR | O_NONBLOCK);
+        if (fd < 0)
+            continue;
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+        evdevs[new_evdev_cnt].file =
+            twin_set_file(twin_linux_evdev_read, fd, TWIN_READ, tm);
+        if (!evdevs[new_evdev_cnt].file) {
+            close(fd);
+            continue;
+        }
+#endif
+        evdevs[new_evdev_cnt].idx = i;
+        evdevs[new_evdev_cnt].fd = fd;
+        twin_linux_input_probe(&evdevs[new_evdev_cnt]);
+        new_evdev_cnt++;
+    }
+
+    /* Close disconnected devices */
+    for (size_t i = 0; i < tm->evdev_cnt; i++)
+        if (tm->evdevs[i].fd >= 0)
+            twin_linux_evdev_close(tm, &tm->evdevs[i]);
+
+    /* Overwrite the evdev list */
+    memcpy(tm->evdevs, evdevs, sizeof(tm->evdevs));
+    tm->evdev_cnt = new_evdev_cnt;
+}
+
+static struct evdev_info *twin_linux_evdev_find(twin_linux_input_t *tm,
+                                                int fd)
+{
+    for (size_t i = 0; i < tm->evdev_cnt; i++)
+        if (tm->evdevs[i].fd == fd)
+            return &tm->evdevs[i];
+    return NULL;
+}
+
+/* Returns false once the device has gone away */
+static bool twin_linux_evdev_drain(twin_linux_input_t *tm, int fd)
+{
+    struct evdev_info *evdev = twin_linux_evdev_find(tm, fd);
+    struct input_event evs[64];
+    ssize_t n;
+
+    if (!evdev)
+        return true;
+
+    /* Read whatever is queued and handle it record by record */
+    while ((n = read(fd, evs, sizeof(evs))) > 0)
+        for (ssize_t j = 0; j < n / (ssize_t) sizeof(evs[0]); j++)
+            twin_linux_input_events(&evs[j], tm, evdev);
+    return !(n < 0 && errno == ENODEV);
+}
+
+/* Drop an unplugged device at once: its node may outlive it for a while,
+ * and until then the dead fd keeps reporting a hang-up. Re-opening is left
+ * to the hotplug handler.
+ */
+static void twin_linux_evdev_remove(twin_linux_input_t *tm, int fd)
+{
+    struct evdev_info *evdev = twin_linux_evdev_find(tm, fd);
+    if (!evdev)
+        return;
+
+    twin_linux_evdev_close(tm, evdev);
+    size_t i = evdev - tm->evdevs;
+    tm->evdev_cnt--;
+    memmove(evdev, evdev + 1, (tm->evdev_cnt - i) * sizeof(*evdev));
+}
+
+#if defined(CONFIG_LINUX_INPUT_MAINLOOP)
+static bool twin_linux_evdev_read(int file,
+                                  twin_file_op_t ops maybe_unused,
+                                  void *closure)
+{
+    /* An unplugged device stays readable until it is closed */
+    if (!twin_linux_evdev_drain(closure, file))
+        twin_linux_evdev_remove(closure, file);
+    return true;
+}
+
+static bool twin_linux_hotplug(int file,
+                               twin_file_op_t ops maybe_unused,
+                               void *closure)
+{
+    char buf[1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+
+    while ((n = read(file, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ie = (const struct inotify_event *) p;
+            if (ie->len && !strncmp(ie->name, "event", 5)) {
+                log_info("inotify: /dev/input/%s %s", ie->name,
+                         (ie->mask & IN_DELETE) ? "removed" : "changed");
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + ie->len;
+        }
+    }
+
+    /* Re-open event devices */
+    if (changed)
+        twin_linux_edev_open(closure);
+    return true;
+}
+
+void *twin_linux_input_create(twin_screen_t *screen)
+{
+    /* Create object for handling Linux input system */
+    twin_linux_input_t *tm = calloc(1, sizeof(twin_linux_input_t));
+    if (!tm)
+        return NULL;
+
+    tm->screen = screen;
+
+    /* Centering the cursor position */
+    tm->x = screen->width / 2;
+    tm->y = screen->height / 2;
+
+    /* Device nodes appear once udev has set their permissions */
+    tm->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (tm->fd < 0 ||
+        inotify_add_watch(tm->fd, "/dev/input",
+                          IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        log_error("Failed to watch /dev/input, hotplug is disabled");
+    } else {
+        tm->hotplug = twin_set_file(twin_linux_hotplug, tm->fd, TWIN_READ, tm);
+    }
+
+    /* Open event devices */
+    twin_linux_edev_open(tm);
+    if (tm->evdev_cnt == 0 && !tm->hotplug) {
+        log_error("Failed to open evdev");
+        if (tm->fd >= 0)
+            close(tm->fd);
+        free(tm);
+        return NULL;
+    }
+
+    return tm;
+}
+
+void twin_linux_input_destroy(void *_tm)
+{
+    twin_linux_input_t *tm = _tm;
+
+    for (size_t i = 0; i < tm->evdev_cnt; i++) {
+        twin_clear_file(tm->evdevs[i].file);
+        close(tm->evdevs[i].fd);
+    }
+    if (tm->hotplug)
+        twin_clear_file(tm->hotplug);
+    if (tm->fd >= 0)
+        close(tm->fd);
+    free(tm);
+}
+#else
 static int twin_linux_udev_init(struct udev **udev, struct udev_monitor **mon)
 {
     /* Create udev object */
@@ -169,57 +684,12 @@ static bool twin_linux_udev_update(struct udev_monitor *mon)
     return false;
 }
 
-static void twin_linux_edev_open(struct pollfd *pfds, twin_linux_input_t *tm)
+static void twin_linux_pfds_update(struct pollfd *pfds,
+                                   twin_linux_input_t *tm)
 {
-    /* New event device list */
-    struct evdev_info evdevs[EVDEV_CNT_MAX];
-    int new_evdev_cnt = 0;
-    memset(evdevs, 0, sizeof(evdevs));
-
-    /* Open all event devices */
-    char evdev_name[EVDEV_NAME_SIZE_MAX] = {0};
-    for (int i = 0; i < EVDEV_CNT_MAX; i++) {
-        /* Check if the file exists */
-        snprintf(evdev_name, EVDEV_NAME_SIZE_MAX, "/dev/input/event%d", i);
-        if (access(evdev_name, F_OK) != 0)
-            continue;
-
-        /* Match device with the old device list  */
-        bool opened = false;
-        for (size_t j = 0; j < tm->evdev_cnt; j++) {
-            /* Copy the fd if the device is already on the list */
-            if (tm->evdevs[j].idx == i) {
-                evdevs[new_evdev_cnt].idx = tm->evdevs[j].idx;
-                evdevs[new_evdev_cnt].fd = tm->evdevs[j].fd;
-                tm->evdevs[j].fd = -1;
-                new_evdev_cnt++;
-                opened = true;
-                break;
-            }
-        }
-
-        /* Open the file if it is not on the list */
-        int fd = open(evdev_name, O_RDWR | O_NONBLOCK);
-        if (fd > 0 && !opened) {
-            evdevs[new_evdev_cnt].idx = i;
-            evdevs[new_evdev_cnt].fd = fd;
-            new_evdev_cnt++;
-        }
-    }
-
-    /* Close disconnected devices */
-    for (size_t i = 0; i < tm->evdev_cnt; i++) {
-        if (tm->evdevs[i].fd > 0)
-            close(tm->evdevs[i].fd);
-    }
-
-    /* Overwrite the evdev list */
-    memcpy(tm->evdevs, evdevs, sizeof(tm->evdevs));
-    tm->evdev_cnt = new_evdev_cnt;
-
     /* Initialize evdev poll file descriptors */
     for (size_t i = tm->udev_cnt; i < tm->evdev_cnt + tm->udev_cnt; i++) {
-        pfds[i].fd = tm->evdevs[i - 1].fd;
+        pfds[i].fd = tm->evdevs[i - tm->udev_cnt].fd;
         pfds[i].events = POLLIN;
     }
 }
@@ -242,7 +712,8 @@ static void *twin_linux_evdev_thread(void *arg)
     pfds[0].events = POLLIN;
 
     /* Open event devices */
-    twin_linux_edev_open(pfds, tm);
+    twin_linux_edev_open(tm);
+    twin_linux_pfds_update(pfds, tm);
 
     /* Accessing to input devices is impossible, terminate the thread */
     if (tm->evdev_cnt == 0 && tm->udev_cnt == 0) {
@@ -251,7 +722,6 @@ static void *twin_linux_evdev_thread(void *arg)
     }
 
     /* Event polling */
-    struct input_event ev;
     while (1) {
         /* Wait until any event is available */
         if (poll(pfds, tm->evdev_cnt + tm->udev_cnt, -1) <= 0)
@@ -263,16 +733,16 @@ static void *twin_linux_evdev_thread(void *arg)
                 /* Check udev event */
                 if (twin_linux_udev_update(mon)) {
                     /* Re-open event devices */
-                    twin_linux_edev_open(pfds, tm);
+                    twin_linux_edev_open(tm);
+                    twin_linux_pfds_update(pfds, tm);
                     break;
                 }
                 continue;
             }
-            /* Try reading events */
-            ssize_t n = read(pfds[i].fd, &ev, sizeof(ev));
-            if (n == sizeof(ev)) {
-                /* Handle events */
-                twin_linux_input_events(&ev, tm);
+            if (!twin_linux_evdev_drain(tm, pfds[i].fd)) {
+                twin_linux_evdev_remove(tm, pfds[i].fd);
+                twin_linux_pfds_update(pfds, tm);
+                break;
             }
         }
     }
@@ -312,3 +782,4 @@ void twin_linux_input_destroy(void *_tm)
     close(tm->fd);
     free(tm);
 }
+#endif /* CONFIG_LINUX_INPUT_MAINLOOP */
@@ -7,19 +7,29 @@
 #include <SDL.h>
 #include <SDL_render.h>
 #include <stdio.h>
+#include <string.h>
 #include <twin.h>
 
 #include "twin_backend.h"
 
 typedef struct {
     SDL_Window *win;
-    int *pixels;
     SDL_Renderer *render;
     SDL_Texture *texture;
-    twin_coord_t width, height;
-    int image_y;
+    /* Damaged part of the texture, locked while it is being composited */
+    SDL_Rect dirty;
+    uint8_t *locked;
+    int pitch;
+    bool vsync;
+    /* User event pushed by other threads to end the wait for events */
+    Uint32 wakeup;
 } twin_sdl_t;
 
+/* Upper bound on one wait, so descriptors watched by the main loop are
+ * still serviced when nothing wakes SDL up.
+ */
+#define TWIN_SDL_WAIT_MAX 100
+
 #define SCREEN(x) ((twin_context_t *) x)->screen
 #define PRIV(x) ((twin_sdl_t *) ((twin_context_t *) x)->priv)
 
@@ -30,9 +40,31 @@ static void _twin_sdl_put_begin(twin_coord_t left,
                                 void *closure)
 {
     twin_sdl_t *tx = PRIV(closure);
-    tx->width = right - left;
-    tx->height = bottom - top;
-    tx->image_y = top;
+    void *pixels;
+
+    tx->dirty = (SDL_Rect) {left, top, right - left, bottom - top};
+    tx->locked = NULL;
+    if (SDL_LockTexture(tx->texture, &tx->dirty, &pixels, &tx->pitch) == 0)
+        tx->locked = pixels;
+    else
+        log_error("%s", SDL_GetError());
+}
+
+/* The locked texture is write-only, but every row is filled before the
+ * compositor blends onto it, so it can be composited in place.
+ */
+static twin_argb32_t *_twin_sdl_get_span(twin_coord_t left,
+                                         twin_coord_t top,
+                                         twin_coord_t right maybe_unused,
+                                         void *closure)
+{
+    twin_sdl_t *tx = PRIV(closure);
+
+    if (!tx->locked)
+        return NULL;
+    return (twin_argb32_t *) (tx->locked +
+                              (top - tx->dirty.y) * tx->pitch) +
+           (left - tx->dirty.x);
 }
 
 static void _twin_sdl_put_span(twin_coord_t left,
@@ -41,24 +73,48 @@ static void _twin_sdl_put_span(twin_coord_t left,
                                twin_argb32_t *pixels,
                                void *closure)
 {
-    twin_screen_t *screen = SCREEN(closure);
     twin_sdl_t *tx = PRIV(closure);
+    twin_argb32_t *dest = _twin_sdl_get_span(left, top, right, closure);
 
-    for (twin_coord_t ix = left, iy = top; ix < right; ix++) {
-        twin_argb32_t pixel = *pixels++;
-        tx->pixels[iy * screen->width + ix] = pixel;
+    /* Rows composited in place need no copy */
+    if (pixels == dest)
+        return;
+    if (dest) {
+        memcpy(dest, pixels, (right - left) * sizeof(*dest));
+    } else {
+        SDL_Rect row = {left, top, right - left, 1};
+        SDL_UpdateTexture(tx->texture, &row, pixels,
+                          (right - left) * sizeof(*pixels));
     }
-    if ((top + 1 - tx->image_y) == tx->height) {
-        SDL_UpdateTexture(tx->texture, NULL, tx->pixels,
-                          screen->width * sizeof(*pixels));
-        SDL_RenderCopy(tx->render, tx->texture, NULL, NULL);
-        SDL_RenderPresent(tx->render);
+}
+
+/* Show what the last update drew, once per composited frame */
+static void _twin_sdl_present(twin_sdl_t *tx)
+{
+    if (tx->locked) {
+        SDL_UnlockTexture(tx->texture);
+        tx->locked = NULL;
     }
+    SDL_RenderCopy(tx->render, tx->texture, NULL, NULL);
+    SDL_RenderPresent(tx->render);
+
+    /* A vsync'd present returns at the refresh, which drives frames */
+    if (tx->vsync)
+        _twin_frame_vblank(_twin_now_nsec());
+}
+
+static void _twin_sdl_wakeup(void *closure)
+{
+    twin_sdl_t *tx = closure;
+    SDL_Event ev = {.type = tx->wakeup};
+
+    SDL_PushEvent(&ev);
 }
 
 static void _twin_sdl_destroy(twin_screen_t *screen maybe_unused,
                               twin_sdl_t *tx)
 {
+    _twin_set_wakeup(NULL, NULL);
     SDL_DestroyTexture(tx->texture);
     SDL_DestroyRenderer(tx->render);
     SDL_DestroyWindow(tx->win);
@@ -75,9 +131,14 @@ static void twin_sdl_damage(twin_screen_t *screen, twin_sdl_t *tx)
 static bool twin_sdl_work(void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
+    twin_sdl_t *tx = PRIV(closure);
 
-    if (twin_screen_damaged(screen))
+    if (twin_screen_damaged(screen)) {
+        tx->dirty.w = tx->dirty.h = 0;
         twin_screen_update(screen);
+        if (tx->dirty.w > 0 && tx->dirty.h > 0)
+            _twin_sdl_present(tx);
+    }
     return true;
 }
 
@@ -108,14 +169,16 @@ twin_context_t *twin_sdl_init(int width, int height)
         goto bail;
     }
 
-    tx->pixels = malloc(width * height * sizeof(*tx->pixels));
-    memset(tx->pixels, 255, width * height * sizeof(*tx->pixels));
-
-    tx->render = SDL_CreateRenderer(tx->win, -1, SDL_RENDERER_ACCELERATED);
+    tx->render = SDL_CreateRenderer(
+        tx->win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!tx->render) {
         log_error("%s", SDL_GetError());
-        goto bail_pixels;
+        goto bail;
     }
+
+    SDL_RendererInfo info;
+    tx->vsync = !SDL_GetRendererInfo(tx->render, &info) &&
+                (info.flags & SDL_RENDERER_PRESENTVSYNC);
     SDL_SetRenderDrawColor(tx->render, 255, 255, 255, 255);
     SDL_RenderClear(tx->render);
 
@@ -124,13 +187,16 @@ twin_context_t *twin_sdl_init(int width, int height)
 
     ctx->screen = twin_screen_create(width, height, _twin_sdl_put_begin,
                                      _twin_sdl_put_span, ctx);
+    twin_screen_register_get_span(ctx->screen, _twin_sdl_get_span);
 
     twin_set_work(twin_sdl_work, TWIN_WORK_REDISPLAY, ctx);
 
+    tx->wakeup = SDL_RegisterEvents(1);
+    if (tx->wakeup != (Uint32) -1)
+        _twin_set_wakeup(_twin_sdl_wakeup, tx);
+
     return ctx;
 
-bail_pixels:
-    free(tx->pixels);
 bail:
     free(ctx->priv);
     free(ctx);
@@ -144,58 +210,80 @@ static void twin_sdl_configure(twin_context_t *ctx)
     twin_screen_resize(ctx->screen, width, height);
 }
 
-static bool twin_sdl_poll(twin_context_t *ctx)
+static bool twin_sdl_event(twin_context_t *ctx, SDL_Event *ev)
 {
     twin_screen_t *screen = SCREEN(ctx);
     twin_sdl_t *tx = PRIV(ctx);
+    twin_event_t tev;
 
-    SDL_Event ev;
-    while (SDL_PollEvent(&ev)) {
-        twin_event_t tev;
-        switch (ev.type) {
-        case SDL_WINDOWEVENT:
-            if (ev.window.event == SDL_WINDOWEVENT_EXPOSED ||
-                ev.window.event == SDL_WINDOWEVENT_SHOWN) {
-                twin_sdl_damage(screen, tx);
-            }
-            break;
-        case SDL_QUIT:
-            _twin_sdl_destroy(screen, tx);
-            return false;
-        case SDL_MOUSEBUTTONDOWN:
-        case SDL_MOUSEBUTTONUP:
-            tev.u.pointer.screen_x = ev.button.x;
-            tev.u.pointer.screen_y = ev.button.y;
-            tev.u.pointer.button =
-                ((ev.button.state >> 8) | (1 << (ev.button.button - 1)));
-            tev.kind = ((ev.type == SDL_MOUSEBUTTONDOWN) ? TwinEventButtonDown
-                                                         : TwinEventButtonUp);
-            twin_screen_dispatch(screen, &tev);
-            break;
-        case SDL_KEYDOWN:
-        case SDL_KEYUP:
-            tev.u.key.key = ev.key.keysym.sym;
-            tev.kind = ((ev.key.type == SDL_KEYDOWN) ? TwinEventKeyDown
-                                                     : TwinEventKeyUp);
-            twin_screen_dispatch(screen, &tev);
-            break;
-        case SDL_MOUSEMOTION:
-            tev.u.pointer.screen_x = ev.motion.x;
-            tev.u.pointer.screen_y = ev.motion.y;
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.button = ev.motion.state;
-            twin_screen_dispatch(screen, &tev);
-            break;
+    switch (ev->type) {
+    case SDL_WINDOWEVENT:
+        if (ev->window.event == SDL_WINDOWEVENT_EXPOSED ||
+            ev->window.event == SDL_WINDOWEVENT_SHOWN) {
+            twin_sdl_damage(screen, tx);
         }
+        break;
+    case SDL_QUIT:
+        _twin_sdl_destroy(screen, tx);
+        return false;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        tev.u.pointer.screen_x = ev->button.x;
+        tev.u.pointer.screen_y = ev->button.y;
+        tev.u.pointer.button =
+            ((ev->button.state >> 8) | (1 << (ev->button.button - 1)));
+        tev.kind = ((ev->type == SDL_MOUSEBUTTONDOWN) ? TwinEventButtonDown
+                                                      : TwinEventButtonUp);
+        twin_screen_dispatch(screen, &tev);
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        tev.u.key.key = ev->key.keysym.sym;
+        tev.kind = ((ev->key.type == SDL_KEYDOWN) ? TwinEventKeyDown
+                                                  : TwinEventKeyUp);
+        twin_screen_dispatch(screen, &tev);
+        break;
+    case SDL_MOUSEMOTION:
+        tev.u.pointer.screen_x = ev->motion.x;
+        tev.u.pointer.screen_y = ev->motion.y;
+        tev.kind = TwinEventMotion;
+        tev.u.pointer.button = ev->motion.state;
+        twin_screen_dispatch(screen, &tev);
+        break;
     }
     return true;
 }
 
+/*
+ * Sleep in SDL until an event arrives, the next timeout is due or another
+ * thread wakes the main loop, then drain whatever else is queued.
+ */
+static bool twin_sdl_poll(twin_context_t *ctx)
+{
+    twin_time_t timeout = _twin_timeout_delay();
+    SDL_Event ev;
+
+    /* Damage and work left behind by this pass are handled without
+     * sleeping first
+     */
+    if (twin_screen_damaged(SCREEN(ctx)) || _twin_work_pending())
+        timeout = 0;
+    else if (timeout < 0 || timeout > TWIN_SDL_WAIT_MAX)
+        timeout = TWIN_SDL_WAIT_MAX;
+
+    if (!SDL_WaitEventTimeout(&ev, timeout))
+        return true;
+    do {
+        if (!twin_sdl_event(ctx, &ev))
+            return false;
+    } while (SDL_PollEvent(&ev));
+    return true;
+}
+
 static void twin_sdl_exit(twin_context_t *ctx)
 {
     if (!ctx)
         return;
-    free(PRIV(ctx)->pixels);
     free(ctx->priv);
     free(ctx);
 }
@@ -29,12 +29,27 @@ All rights reserved.
 #define DRM_FORMAT_ARGB8888 fourcc_code('A', 'R', '2', '4')
 #endif
 
+/* Frames are composed into buffers from an nvnc_fb_pool, which only hands a
+ * buffer out again once every encoder has released it. Each buffer keeps
+ * the area of the screen that changed since it was last drawn into.
+ */
+#define TWIN_VNC_BUFFERS_MAX 8
+
+typedef struct {
+    struct nvnc_fb *fb;
+    struct pixman_region16 stale;
+} twin_vnc_buffer_t;
+
 typedef struct {
     twin_screen_t *screen;
     struct aml *aml;
     struct aml_handler *aml_handler;
+    twin_file_t *aml_file;
     struct nvnc *server;
     struct nvnc_display *display;
+    struct nvnc_fb_pool *pool;
+    twin_vnc_buffer_t buffers[TWIN_VNC_BUFFERS_MAX];
+    int n_buffers;
     struct nvnc_fb *current_fb;
     struct pixman_region16 damage_region;
     uint32_t *framebuffer;
@@ -56,12 +71,20 @@ static void _twin_vnc_put_begin(twin_coord_t left,
                                 twin_coord_t bottom,
                                 void *closure)
 {
-    (void) left;
-    (void) top;
-    (void) right;
-    (void) bottom;
     twin_vnc_t *tx = PRIV(closure);
-    pixman_region_init_rect(&tx->damage_region, 0, 0, tx->width, tx->height);
+
+    /* The rows about to be drawn are all that clients need to fetch */
+    pixman_region_union_rect(&tx->damage_region, &tx->damage_region, left, top,
+                             right - left, bottom - top);
+}
+
+static twin_argb32_t *_twin_vnc_get_span(twin_coord_t left,
+                                         twin_coord_t top,
+                                         twin_coord_t right maybe_unused,
+                                         void *closure)
+{
+    twin_vnc_t *tx = PRIV(closure);
+    return tx->framebuffer + top * tx->width + left;
 }
 
 static void _twin_vnc_put_span(twin_coord_t left,
@@ -74,15 +97,78 @@ static void _twin_vnc_put_span(twin_coord_t left,
     uint32_t *fb_pixels = tx->framebuffer + top * tx->width + left;
     size_t span_width = right - left;
 
-    memcpy(fb_pixels, pixels, span_width * sizeof(*fb_pixels));
-    pixman_region_union_rect(&tx->damage_region, &tx->damage_region, left, top,
-                             span_width, 1);
+    /* Rows composited in place need no copy */
+    if (pixels != fb_pixels)
+        memcpy(fb_pixels, pixels, span_width * sizeof(*fb_pixels));
 }
 
 static void twin_vnc_get_screen_size(twin_vnc_t *tx, int *width, int *height)
 {
-    *width = nvnc_fb_get_width(tx->current_fb);
-    *height = nvnc_fb_get_height(tx->current_fb);
+    *width = tx->width;
+    *height = tx->height;
+}
+
+static twin_vnc_buffer_t *_twin_vnc_buffer(twin_vnc_t *tx, struct nvnc_fb *fb)
+{
+    for (int i = 0; i < tx->n_buffers; i++)
+        if (tx->buffers[i].fb == fb)
+            return &tx->buffers[i];
+    if (tx->n_buffers == TWIN_VNC_BUFFERS_MAX)
+        return NULL;
+
+    /* A buffer new to the pool holds nothing of the screen yet */
+    twin_vnc_buffer_t *buf = &tx->buffers[tx->n_buffers++];
+    buf->fb = fb;
+    pixman_region_init_rect(&buf->stale, 0, 0, tx->width, tx->height);
+    return buf;
+}
+
+/* Take a free buffer and bring it up to date with the last frame, except
+ * where the coming update will draw anyway
+ */
+static struct nvnc_fb *_twin_vnc_acquire(twin_vnc_t *tx, twin_screen_t *screen)
+{
+    struct nvnc_fb *fb = nvnc_fb_pool_acquire(tx->pool);
+    if (!fb) {
+        log_error("Failed to acquire a VNC framebuffer");
+        return NULL;
+    }
+
+    twin_vnc_buffer_t *buf = _twin_vnc_buffer(tx, fb);
+    struct pixman_region16 copy;
+    pixman_region_init_rect(&copy, 0, 0, tx->width, tx->height);
+    if (buf)
+        pixman_region_copy(&copy, &buf->stale);
+
+    pthread_mutex_lock(&screen->damage_lock);
+    twin_rect_t damage = screen->damage;
+    pthread_mutex_unlock(&screen->damage_lock);
+    struct pixman_region16 drawn;
+    pixman_region_init_rect(&drawn, damage.left, damage.top,
+                            damage.right - damage.left,
+                            damage.bottom - damage.top);
+    pixman_region_subtract(&copy, &copy, &drawn);
+    pixman_region_fini(&drawn);
+
+    uint32_t *dst = nvnc_fb_get_addr(fb);
+    if (tx->current_fb) {
+        const uint32_t *src = nvnc_fb_get_addr(tx->current_fb);
+        int n;
+        pixman_box16_t *box = pixman_region_rectangles(&copy, &n);
+        for (int i = 0; i < n; i++) {
+            for (int y = box[i].y1; y < box[i].y2; y++) {
+                size_t off = (size_t) y * tx->width + box[i].x1;
+                memcpy(dst + off, src + off,
+                       (box[i].x2 - box[i].x1) * sizeof(*dst));
+            }
+        }
+    }
+    pixman_region_fini(&copy);
+    if (buf)
+        pixman_region_clear(&buf->stale);
+
+    tx->framebuffer = dst;
+    return fb;
 }
 
 static bool _twin_vnc_work(void *closure)
@@ -90,10 +176,24 @@ static bool _twin_vnc_work(void *closure)
     twin_screen_t *screen = SCREEN(closure);
     twin_vnc_t *tx = PRIV(closure);
     if (twin_screen_damaged(screen)) {
+        struct nvnc_fb *fb = _twin_vnc_acquire(tx, screen);
+        if (!fb)
+            return true;
+
         pixman_region_clear(&tx->damage_region);
         twin_screen_update(screen);
-        nvnc_display_feed_buffer(tx->display, tx->current_fb,
-                                 &tx->damage_region);
+
+        /* Every other buffer now lags behind by what was just drawn */
+        for (int i = 0; i < tx->n_buffers; i++)
+            if (tx->buffers[i].fb != fb)
+                pixman_region_union(&tx->buffers[i].stale,
+                                    &tx->buffers[i].stale, &tx->damage_region);
+
+        /* The display holds the buffer until the encoders are done */
+        nvnc_display_feed_buffer(tx->display, fb, &tx->damage_region);
+        if (tx->current_fb)
+            nvnc_fb_unref(tx->current_fb);
+        tx->current_fb = fb;
     }
     return true;
 }
@@ -161,6 +261,16 @@ static struct nvnc_fb *_twin_vnc_create_cursor()
     return fb;
 }
 
+static bool _twin_vnc_read_events(int file maybe_unused,
+                                  twin_file_op_t ops maybe_unused,
+                                  void *closure)
+{
+    twin_vnc_t *tx = closure;
+    aml_poll(tx->aml, 0);
+    aml_dispatch(tx->aml);
+    return true;
+}
+
 twin_context_t *twin_vnc_init(int width, int height)
 {
     twin_context_t *ctx = calloc(1, sizeof(twin_context_t));
@@ -223,18 +333,22 @@ twin_context_t *twin_vnc_init(int width, int height)
                                      _twin_vnc_put_span, ctx);
     if (!ctx->screen)
         goto bail_display;
+    twin_screen_register_get_span(ctx->screen, _twin_vnc_get_span);
+
+    pixman_region_init(&tx->damage_region);
 
-    tx->framebuffer = calloc(width * height, sizeof(uint32_t));
-    if (!tx->framebuffer) {
-        log_error("Failed to allocate framebuffer");
+    tx->pool = nvnc_fb_pool_new(width, height, DRM_FORMAT_ARGB8888, width);
+    if (!tx->pool) {
+        log_error("Failed to create VNC framebuffer pool");
         goto bail_screen;
     }
 
-    tx->current_fb = nvnc_fb_from_buffer(tx->framebuffer, width, height,
-                                         DRM_FORMAT_ARGB8888, width);
-    if (!tx->current_fb) {
-        log_error("Failed to init VNC framebuffer");
-        goto bail_framebuffer;
+    /* aml exposes a single descriptor covering all of its sources */
+    tx->aml_file = twin_set_file(_twin_vnc_read_events, aml_get_fd(tx->aml),
+                                 TWIN_READ, tx);
+    if (!tx->aml_file) {
+        log_error("Failed to watch the aml event loop");
+        goto bail_pool;
     }
 
     twin_set_work(_twin_vnc_work, TWIN_WORK_REDISPLAY, ctx);
@@ -242,9 +356,10 @@ twin_context_t *twin_vnc_init(int width, int height)
 
     return ctx;
 
-bail_framebuffer:
-    free(tx->framebuffer);
+bail_pool:
+    nvnc_fb_pool_unref(tx->pool);
 bail_screen:
+    pixman_region_fini(&tx->damage_region);
     twin_screen_destroy(ctx->screen);
 bail_display:
     nvnc_display_unref(tx->display);
@@ -258,14 +373,6 @@ bail_priv:
     return NULL;
 }
 
-static bool twin_vnc_poll(twin_context_t *ctx)
-{
-    twin_vnc_t *tx = PRIV(ctx);
-    aml_poll(tx->aml, 0);
-    aml_dispatch(tx->aml);
-    return true;
-}
-
 static void twin_vnc_configure(twin_context_t *ctx)
 {
     int width, height;
@@ -280,19 +387,23 @@ static void twin_vnc_exit(twin_context_t *ctx)
         return;
 
     twin_vnc_t *tx = PRIV(ctx);
-    nvnc_fb_unref(tx->current_fb);
+    twin_clear_file(tx->aml_file);
+    if (tx->current_fb)
+        nvnc_fb_unref(tx->current_fb);
     nvnc_display_unref(tx->display);
     nvnc_close(tx->server);
     aml_unref(tx->aml);
 
-    free(tx->framebuffer);
+    for (int i = 0; i < tx->n_buffers; i++)
+        pixman_region_fini(&tx->buffers[i].stale);
+    nvnc_fb_pool_unref(tx->pool);
+    pixman_region_fini(&tx->damage_region);
     free(ctx->priv);
     free(ctx);
 }
 
 const twin_backend_t g_twin_backend = {
     .init = twin_vnc_init,
-    .poll = twin_vnc_poll,
     .configure = twin_vnc_configure,
     .exit = twin_vnc_exit,
 };
@@ -0,0 +1,27 @@
+#define CONFIG_CONFIGURED 1
+#define CONFIG_BACKEND_FBDEV 1
+#define CONFIG_RENDERER_BUILTIN 1
+#define CONFIG_LOGGING 1
+#define CONFIG_LOGGING_COLOR 1
+#define CONFIG_LOGGING_CALLBACK 1
+#define CONFIG_CURSOR 1
+#define CONFIG_DROP_SHADOW 1
+#define CONFIG_HORIZONTAL_OFFSET 1
+#define CONFIG_VERTICAL_OFFSET 1
+#define CONFIG_SHADOW_BLUR 10
+#define CONFIG_LOADER_PNG 1
+#define CONFIG_LOADER_JPEG 1
+#define CONFIG_LOADER_GIF 1
+#define CONFIG_LOADER_TVG 1
+#define CONFIG_DEMO_APPLICATIONS 1
+#define CONFIG_DEMO_MULTI 1
+#define CONFIG_DEMO_HELLO 1
+#define CONFIG_DEMO_CLOCK 1
+#define CONFIG_DEMO_CALCULATOR 1
+#define CONFIG_DEMO_LINE 1
+#define CONFIG_DEMO_SPLINE 1
+#define CONFIG_DEMO_ANIMATION 1
+#define CONFIG_DEMO_IMAGE 1
+#define CONFIG_LINUX_INPUT_THREAD 1
+#define CONFIG_FBDEV_PAGE_FLIP 1
+#define CONFIG_FBDEV_SHADOW 1
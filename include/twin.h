@@ -8,6 +8,7 @@
 #ifndef _TWIN_H_
 #define _TWIN_H_
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -74,6 +75,8 @@ typedef struct _twin_window twin_window_t;
 typedef struct _twin_screen twin_screen_t;
 typedef struct _twin_pixmap twin_pixmap_t;
 typedef struct _twin_animation twin_animation_t;
+typedef struct _twin_record twin_record_t;
+typedef struct _twin_replay twin_replay_t;
 
 /*
  * Events
@@ -99,6 +102,11 @@ typedef enum _twin_event_kind {
     TwinEventJoyButton = 0x0401,
     TwinEventJoyAxis = 0x0402,
 
+    /* Touch */
+    TwinEventTouchDown = 0x0801,
+    TwinEventTouchUp = 0x0802,
+    TwinEventTouchMotion = 0x0803,
+
     /* Widgets */
     TwinEventPaint = 0x1001,
     TwinEventQueryGeometry = 0x1002,
@@ -106,6 +114,9 @@ typedef enum _twin_event_kind {
     TwinEventDestroy = 0x1004,
 } twin_event_kind_t;
 
+/* Simultaneous touch contacts tracked per screen */
+#define TWIN_TOUCH_MAX 10
+
 typedef struct _twin_event {
     twin_event_kind_t kind;
     union {
@@ -117,6 +128,12 @@ typedef struct _twin_event {
         struct {
             twin_keysym_t key;
         } key;
+        struct {
+            twin_coord_t x, y;
+            twin_coord_t screen_x, screen_y;
+            /* Contact number, stable from TouchDown until TouchUp */
+            twin_count_t id;
+        } touch;
         struct {
             twin_js_number_t control;
             twin_js_value_t value;
@@ -142,6 +159,18 @@ typedef struct _twin_animation_iter {
     twin_time_t current_delay;
 } twin_animation_iter_t;
 
+/*
+ * Produces the frames of an animation one at a time, as it plays
+ */
+typedef struct _twin_animation_decoder {
+    /* Decode the next frame into 'frame'; false at the end of the stream */
+    bool (*next)(void *closure, twin_pixmap_t *frame, twin_time_t *delay);
+    /* Start over from the first frame */
+    void (*rewind)(void *closure);
+    void (*close)(void *closure);
+    void *closure;
+} twin_animation_decoder_t;
+
 typedef struct _twin_animation {
     /* Array of pixmaps representing each frame of the animation */
     twin_pixmap_t **frames;
@@ -154,6 +183,15 @@ typedef struct _twin_animation {
     twin_animation_iter_t *iter;
     twin_coord_t width;  /* pixels */
     twin_coord_t height; /* pixels */
+    /*
+     * Animations decoded on demand keep only a ring of the n_frames most
+     * recently decoded frames, allocated as they are first needed. 'length'
+     * is the number of frames in the stream once it has been played through
+     * and zero before; 'decoded' counts the frames of the current pass.
+     */
+    twin_animation_decoder_t *decoder;
+    twin_count_t length;
+    twin_count_t decoded;
 } twin_animation_t;
 
 /*
@@ -210,11 +248,20 @@ typedef struct _twin_pixmap {
      * refers to the window object
      */
     twin_window_t *window;
+
+    /*
+     * Held while pixels are drawn from another thread and while the
+     * screen composites them
+     */
+    pthread_mutex_t lock;
 } twin_pixmap_t;
 
 /*
  * twin_put_begin_t: called before data are drawn to the screen
  * twin_put_span_t: called for each scanline drawn
+ * twin_get_span_t: optionally returns the ARGB32 output row for a scanline
+ *                  so that it is composited in place; 'pixels' of the
+ *                  following put_span then points into that row
  */
 typedef void (*twin_put_begin_t)(twin_coord_t left,
                                  twin_coord_t top,
@@ -226,6 +273,10 @@ typedef void (*twin_put_span_t)(twin_coord_t left,
                                 twin_coord_t right,
                                 twin_argb32_t *pixels,
                                 void *closure);
+typedef twin_argb32_t *(*twin_get_span_t)(twin_coord_t left,
+                                          twin_coord_t top,
+                                          twin_coord_t right,
+                                          void *closure);
 
 /*
  * A screen
@@ -247,6 +298,11 @@ struct _twin_screen {
     twin_pixmap_t *target;
     bool clicklock;
 
+    /*
+     * pixmap each touch contact went down on, indexed by contact id
+     */
+    twin_pixmap_t *touch_target[TWIN_TOUCH_MAX];
+
     /*
      * mouse image (optional)
      */
@@ -267,18 +323,25 @@ struct _twin_screen {
     twin_pixmap_t *background;
 
     /*
-     * Damage
+     * Damage, guarded by damage_lock together with 'disable'
      */
     twin_rect_t damage;
     void (*damaged)(void *);
     void *damaged_closure;
     twin_count_t disable;
+    pthread_mutex_t damage_lock;
+
+    /*
+     * Guards the pixmap stack; taken before any pixmap lock
+     */
+    pthread_mutex_t lock;
 
     /*
      * Repaint function
      */
     twin_put_begin_t put_begin;
     twin_put_span_t put_span;
+    twin_get_span_t get_span;
     void *closure;
 
     /*
@@ -290,6 +353,12 @@ struct _twin_screen {
      * Event filter
      */
     bool (*event_filter)(twin_screen_t *screen, twin_event_t *event);
+
+    /*
+     * Input trace being recorded or replayed (optional)
+     */
+    twin_record_t *record;
+    twin_replay_t *replay;
 };
 
 /*
@@ -474,10 +543,37 @@ typedef twin_time_t (*twin_timeout_proc_t)(twin_time_t now, void *closure);
 
 typedef bool (*twin_work_proc_t)(void *closure);
 
+/*
+ * File procs are called from the main loop when the file becomes ready
+ * for any of the requested operations; return false to stop watching it.
+ */
+typedef enum _twin_file_op { TWIN_READ = 1, TWIN_WRITE = 2 } twin_file_op_t;
+
+typedef bool (*twin_file_proc_t)(int file, twin_file_op_t ops, void *closure);
+
 #define twin_time_compare(a, op, b) (((a) - (b)) op 0)
 
 typedef struct _twin_timeout twin_timeout_t;
 typedef struct _twin_work twin_work_t;
+typedef struct _twin_file twin_file_t;
+
+/*
+ * Job procs run on a worker thread. The done proc then runs exactly once
+ * on the main loop; 'cancelled' is set when the job was cleared first.
+ */
+typedef void (*twin_job_proc_t)(void *closure);
+
+typedef void (*twin_job_done_t)(void *closure, bool cancelled);
+
+typedef struct _twin_job twin_job_t;
+
+/*
+ * Frame procs run once per display refresh with the time at which the
+ * frame is expected to be presented; return true to run again next frame.
+ */
+typedef bool (*twin_frame_proc_t)(twin_time_t target, void *closure);
+
+typedef struct _twin_frame twin_frame_t;
 
 /*
  * Widgets
@@ -693,8 +789,23 @@ void twin_cover(twin_pixmap_t *dst,
  * event.c
  */
 
+/*
+ * Queue an event for the main loop; safe to call from one thread other than
+ * the dispatching one.
+ */
 void twin_event_enqueue(const twin_event_t *event);
 
+/*
+ * file.c
+ */
+
+twin_file_t *twin_set_file(twin_file_proc_t file_proc,
+                           int file,
+                           twin_file_op_t ops,
+                           void *closure);
+
+void twin_clear_file(twin_file_t *file);
+
 /*
  * fixed.c
  */
@@ -729,6 +840,14 @@ void twin_text_metrics_utf8(twin_path_t *path,
                             const char *string,
                             twin_text_metrics_t *m);
 
+/*
+ * frame.c
+ */
+
+twin_frame_t *twin_set_frame(twin_frame_proc_t frame_proc, void *closure);
+
+void twin_clear_frame(twin_frame_t *frame);
+
 /*
  * hull.c
  */
@@ -749,6 +868,34 @@ void twin_icon_draw(twin_pixmap_t *pixmap,
 
 twin_pixmap_t *twin_pixmap_from_file(const char *path, twin_format_t fmt);
 
+/*
+ * Load an image resampled to width x height. JPEG images are shrunk while
+ * decoding, so large photos never exist at full size in memory.
+ */
+twin_pixmap_t *twin_pixmap_from_file_scale(const char *path,
+                                           twin_format_t fmt,
+                                           twin_coord_t width,
+                                           twin_coord_t height);
+
+/*
+ * Decoded images are kept in a shared cache, so loading the same file again
+ * only copies pixels. twin_image_cache_acquire() skips even the copy: the
+ * pixmap it returns is shared, must not be modified or destroyed, and is
+ * handed back with twin_image_cache_release(). Animations, and images that
+ * do not fit the budget, are not shared: each acquire decodes a private
+ * copy, which the release destroys. Unreferenced images are evicted, least
+ * recently used first, beyond the budget in bytes; a budget of zero
+ * disables caching.
+ */
+twin_pixmap_t *twin_image_cache_acquire(const char *path,
+                                        twin_format_t fmt,
+                                        twin_coord_t width,
+                                        twin_coord_t height);
+
+void twin_image_cache_release(twin_pixmap_t *pixmap);
+
+void twin_image_cache_set_budget(size_t bytes);
+
 /*
  * animation.c
  *
@@ -1022,6 +1169,10 @@ void twin_pixmap_damage(twin_pixmap_t *pixmap,
                         twin_coord_t right,
                         twin_coord_t bottom);
 
+/*
+ * Threads other than the dispatching one hold the pixmap lock while drawing
+ * into it; twin_screen_update() takes it while compositing the pixmap.
+ */
 void twin_pixmap_lock(twin_pixmap_t *pixmap);
 
 void twin_pixmap_unlock(twin_pixmap_t *pixmap);
@@ -1049,6 +1200,28 @@ void twin_fill_path(twin_pixmap_t *pixmap,
                     twin_coord_t dx,
                     twin_coord_t dy);
 
+/*
+ * record.c
+ */
+
+/*
+ * Append every input event passed to twin_screen_dispatch() to the trace
+ * file at 'path', stamped with its arrival time.
+ */
+bool twin_screen_record(twin_screen_t *screen, const char *path);
+
+void twin_screen_record_stop(twin_screen_t *screen);
+
+/*
+ * Dispatch the events of a recorded trace at 'speed' times their original
+ * pace, or one per main loop pass when 'speed' is zero, and time every frame
+ * composited meanwhile. twin_dispatch() returns once the last event has been
+ * composited.
+ */
+bool twin_screen_replay(twin_screen_t *screen, const char *path, double speed);
+
+void twin_screen_replay_stop(twin_screen_t *screen);
+
 /*
  * screen.c
  */
@@ -1075,6 +1248,9 @@ void twin_screen_register_damaged(twin_screen_t *screen,
                                   void (*damaged)(void *),
                                   void *closure);
 
+void twin_screen_register_get_span(twin_screen_t *screen,
+                                   twin_get_span_t get_span);
+
 void twin_screen_resize(twin_screen_t *screen,
                         twin_coord_t width,
                         twin_coord_t height);
@@ -1098,6 +1274,10 @@ void twin_screen_set_cursor(twin_screen_t *screen,
 
 bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event);
 
+/*
+ * Guards the stack of pixmaps shown on the screen. It may be taken
+ * recursively and must be acquired before any pixmap lock.
+ */
 void twin_screen_lock(twin_screen_t *screen);
 
 void twin_screen_unlock(twin_screen_t *screen);
@@ -1125,6 +1305,8 @@ void twin_path_quadratic_curve(twin_path_t *path,
  * timeout.c
  */
 
+twin_time_t twin_now(void);
+
 twin_timeout_t *twin_set_timeout(twin_timeout_proc_t timeout_proc,
                                  twin_time_t delay,
                                  void *closure);
@@ -1236,8 +1418,29 @@ twin_work_t *twin_set_work(twin_work_proc_t work_proc,
                            int priority,
                            void *closure);
 
+/*
+ * Like twin_set_work(), but returns the pending item for (work_proc, closure)
+ * instead of queueing a duplicate when one exists.
+ */
+twin_work_t *twin_set_work_once(twin_work_proc_t work_proc,
+                                int priority,
+                                void *closure);
+
 void twin_clear_work(twin_work_t *work);
 
+/*
+ * worker.c
+ */
+
+/* Jobs with a higher priority are picked by the worker threads first */
+twin_job_t *twin_set_job(twin_job_proc_t job_proc,
+                         twin_job_done_t done_proc,
+                         int priority,
+                         void *closure);
+
+/* Only valid until the done proc of the job has run */
+void twin_clear_job(twin_job_t *job);
+
 /*
  * image-tvg.c
  */
@@ -514,21 +514,53 @@ typedef struct _twin_queue {
     bool deleted;
 } twin_queue_t;
 
+/* Nanoseconds on CLOCK_MONOTONIC */
+typedef int64_t twin_nsec_t;
+
 struct _twin_timeout {
-    twin_queue_t queue;
-    twin_time_t time;
+    twin_nsec_t deadline;
+    int index;
     twin_time_t delay;
     twin_timeout_proc_t proc;
     void *closure;
 };
 
 struct _twin_work {
-    twin_queue_t queue;
+    twin_work_t *next;
+    twin_work_t *hash_next;
     int priority;
+    bool deleted;
+    bool once;
     twin_work_proc_t proc;
     void *closure;
 };
 
+struct _twin_job {
+    twin_queue_t queue;
+    twin_job_t *next;
+    int priority;
+    bool started;
+    bool cancelled;
+    twin_job_proc_t proc;
+    twin_job_done_t done;
+    void *closure;
+};
+
+struct _twin_frame {
+    twin_queue_t queue;
+    bool pending;
+    twin_frame_proc_t proc;
+    void *closure;
+};
+
+struct _twin_file {
+    twin_queue_t queue;
+    int file;
+    twin_file_op_t ops;
+    twin_file_proc_t proc;
+    void *closure;
+};
+
 typedef enum _twin_order {
     TWIN_BEFORE = -1,
     TWIN_AT = 0,
@@ -555,10 +587,61 @@ void _twin_queue_review_order(twin_queue_t *first);
 
 void _twin_run_timeout(void);
 
+twin_nsec_t _twin_now_nsec(void);
+
+/* Absolute deadline of the next timeout, or -1 when none is pending */
+twin_nsec_t _twin_timeout_deadline(void);
+
 twin_time_t _twin_timeout_delay(void);
 
 void _twin_run_work(void);
 
+/* True when work was queued since the last pass began */
+bool _twin_work_pending(void);
+
+/*
+ * Backends that observe the display refresh report each one from the main
+ * loop. The optional arm proc is told whether frames are pending, so the
+ * backend only waits for vblank while someone is animating.
+ */
+typedef void (*twin_vblank_arm_t)(bool armed, void *closure);
+
+void _twin_frame_set_vblank(twin_vblank_arm_t arm, void *closure);
+
+void _twin_frame_vblank(twin_nsec_t when);
+
+/* Leave twin_dispatch() once the current pass is done */
+void _twin_dispatch_stop(void);
+
+/* Start recording or replaying as requested by MADO_RECORD/MADO_REPLAY */
+void _twin_record_init(twin_screen_t *screen);
+
+void _twin_record_event(twin_screen_t *screen, const twin_event_t *event);
+
+/* Account one frame composited while a trace is being replayed */
+void _twin_replay_frame(twin_screen_t *screen, twin_nsec_t elapsed);
+
+/* Deliver events queued through twin_event_enqueue() to 'screen' */
+void _twin_run_event(twin_screen_t *screen);
+
+/*
+ * Block until a watched file is ready, another thread calls _twin_wakeup()
+ * or the absolute 'deadline' passes; a negative deadline waits indefinitely
+ * and zero only polls.
+ */
+void _twin_run_file(twin_nsec_t deadline);
+
+void _twin_wakeup(void);
+
+/*
+ * Backends that block in their own event wait instead of _twin_run_file()
+ * register a proc here; _twin_wakeup() calls it from the waking thread so
+ * the backend can interrupt that wait.
+ */
+typedef void (*twin_wakeup_proc_t)(void *closure);
+
+void _twin_set_wakeup(twin_wakeup_proc_t proc, void *closure);
+
 void _twin_box_init(twin_box_t *box,
                     twin_box_t *parent,
                     twin_window_t *window,
@@ -28,20 +28,94 @@ void twin_animation_advance_frame(twin_animation_t *anim)
     twin_animation_iter_advance(anim->iter);
 }
 
+static void _twin_animation_close(twin_animation_t *anim)
+{
+    twin_animation_decoder_t *decoder = anim->decoder;
+
+    if (!decoder)
+        return;
+    (*decoder->close)(decoder->closure);
+    free(decoder);
+    anim->decoder = NULL;
+}
+
 void twin_animation_destroy(twin_animation_t *anim)
 {
     if (!anim)
         return;
 
+    _twin_animation_close(anim);
     free(anim->iter);
     for (twin_count_t i = 0; i < anim->n_frames; i++) {
-        twin_pixmap_destroy(anim->frames[i]);
+        if (anim->frames[i])
+            twin_pixmap_destroy(anim->frames[i]);
     }
     free(anim->frames);
     free(anim->frame_delays);
     free(anim);
 }
 
+/* Decode the next frame of the stream into ring slot 'slot' */
+static bool _twin_animation_decode(twin_animation_t *anim, twin_count_t slot)
+{
+    twin_animation_decoder_t *decoder = anim->decoder;
+
+    if (!anim->frames[slot]) {
+        anim->frames[slot] =
+            twin_pixmap_create(TWIN_ARGB32, anim->width, anim->height);
+        if (!anim->frames[slot])
+            return false;
+    }
+    if (!(*decoder->next)(decoder->closure, anim->frames[slot],
+                          &anim->frame_delays[slot]))
+        return false;
+    anim->decoded++;
+    return true;
+}
+
+/*
+ * Once a stream has played through and all of it fits in the ring, the
+ * frames are in order from slot 0 and the animation no longer needs its
+ * decoder.
+ */
+static void _twin_animation_settle(twin_animation_t *anim)
+{
+    for (twin_count_t i = anim->length; i < anim->n_frames; i++)
+        if (anim->frames[i])
+            twin_pixmap_destroy(anim->frames[i]);
+    anim->n_frames = anim->length;
+    _twin_animation_close(anim);
+}
+
+static bool _twin_animation_stream_advance(twin_animation_iter_t *iter)
+{
+    twin_animation_t *anim = iter->anim;
+    twin_count_t slot = (iter->current_index + 1) % anim->n_frames;
+
+    if (anim->length && anim->decoded == anim->length && !anim->loop)
+        return true;
+    if (_twin_animation_decode(anim, slot)) {
+        iter->current_index = slot;
+        return true;
+    }
+
+    /* End of the stream */
+    if (!anim->length)
+        anim->length = anim->decoded;
+    if (!anim->loop || !anim->length)
+        return true;
+    if (anim->length <= anim->n_frames) {
+        _twin_animation_settle(anim);
+        return false;
+    }
+
+    (*anim->decoder->rewind)(anim->decoder->closure);
+    anim->decoded = 0;
+    if (_twin_animation_decode(anim, slot))
+        iter->current_index = slot;
+    return true;
+}
+
 twin_animation_iter_t *twin_animation_iter_init(twin_animation_t *anim)
 {
     twin_animation_iter_t *iter = malloc(sizeof(twin_animation_iter_t));
@@ -58,6 +132,14 @@ twin_animation_iter_t *twin_animation_iter_init(twin_animation_t *anim)
 void twin_animation_iter_advance(twin_animation_iter_t *iter)
 {
     twin_animation_t *anim = iter->anim;
+
+    /* Streams fall through here once they are fully cached */
+    if (anim->decoder && _twin_animation_stream_advance(iter)) {
+        iter->current_frame = anim->frames[iter->current_index];
+        iter->current_delay = anim->frame_delays[iter->current_index];
+        return;
+    }
+
     iter->current_index++;
     if (iter->current_index >= anim->n_frames) {
         if (anim->loop) {
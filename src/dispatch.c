@@ -5,24 +5,43 @@
  * All rights reserved.
  */
 
-#include <unistd.h>
-
 #include "twin_backend.h"
 #include "twin_private.h"
 
 extern twin_backend_t g_twin_backend;
 
+static bool stopping;
+
+void _twin_dispatch_stop(void)
+{
+    stopping = true;
+}
+
 void twin_dispatch(twin_context_t *ctx)
 {
+    _twin_record_init(ctx->screen);
+
     for (;;) {
+        _twin_run_event(ctx->screen);
         _twin_run_timeout();
         _twin_run_work();
-
-        if (g_twin_backend.poll && !g_twin_backend.poll(ctx)) {
-            twin_time_t delay = _twin_timeout_delay();
-            if (delay > 0)
-                usleep(delay * 1000);
+        if (stopping) {
+            stopping = false;
             break;
         }
+
+        /* Backends with their own event wait sleep in their poll hook and
+         * only check the watched files here; everything else blocks until
+         * a file, a timeout or queued work needs attention. Work queued by
+         * the pass just run is picked up without sleeping.
+         */
+        if (g_twin_backend.poll) {
+            if (!g_twin_backend.poll(ctx))
+                break;
+            _twin_run_file(0);
+        } else {
+            _twin_run_file(_twin_work_pending() ? 0
+                                                : _twin_timeout_deadline());
+        }
     }
 }
@@ -0,0 +1,118 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <stdatomic.h>
+
+#include "twin_private.h"
+
+/*
+ * Events produced outside the main loop, typically by an input thread, pass
+ * through a bounded single-producer/single-consumer ring. The producer only
+ * advances 'tail' and the main loop only advances 'head', so neither side
+ * takes a lock.
+ *
+ * Each slot also carries a sequence number, 'index + 1' while the event in
+ * it is published. Whichever side first swaps it to 'index' owns the slot:
+ * the main loop to read it, or the producer to replace a motion event with
+ * a newer one of the same kind once the ring is crowded.
+ */
+
+#define TWIN_EVENT_RING_SIZE 256
+#define TWIN_EVENT_RING_MASK (TWIN_EVENT_RING_SIZE - 1)
+
+/* Past this fill, motion replaces a matching motion event at the tail
+ * instead of taking a slot, leaving room for buttons
+ */
+#define TWIN_EVENT_MOTION_MAX (TWIN_EVENT_RING_SIZE * 3 / 4)
+
+static twin_event_t ring[TWIN_EVENT_RING_SIZE];
+static atomic_uint seq[TWIN_EVENT_RING_SIZE];
+static atomic_uint head, tail;
+
+/* Events lost to a full ring, only touched by the producer */
+static unsigned dropped;
+
+static bool _twin_event_coalesce(const twin_event_t *a, const twin_event_t *b)
+{
+    if (a->kind == TwinEventTouchMotion)
+        return b->kind == TwinEventTouchMotion &&
+               a->u.touch.id == b->u.touch.id;
+    return a->kind == TwinEventMotion && b->kind == TwinEventMotion &&
+           a->u.pointer.button == b->u.pointer.button;
+}
+
+/* Overwrite the newest event with 'event' unless the main loop has it */
+static bool _twin_event_replace(unsigned last, const twin_event_t *event)
+{
+    atomic_uint *s = &seq[last & TWIN_EVENT_RING_MASK];
+    unsigned published = last + 1;
+
+    if (!_twin_event_coalesce(&ring[last & TWIN_EVENT_RING_MASK], event) ||
+        !atomic_compare_exchange_strong_explicit(s, &published, last,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed))
+        return false;
+    ring[last & TWIN_EVENT_RING_MASK] = *event;
+    atomic_store_explicit(s, last + 1, memory_order_release);
+    return true;
+}
+
+void twin_event_enqueue(const twin_event_t *event)
+{
+    unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+    unsigned used = t - h;
+    bool motion = event->kind == TwinEventMotion ||
+                  event->kind == TwinEventTouchMotion;
+
+    if (used >= TWIN_EVENT_RING_SIZE ||
+        (motion && used >= TWIN_EVENT_MOTION_MAX)) {
+        /* The latest position must survive, the ones before it need not */
+        if (motion && _twin_event_replace(t - 1, event)) {
+            _twin_wakeup();
+            return;
+        }
+        if (used >= TWIN_EVENT_RING_SIZE) {
+            dropped++;
+            if (!(dropped & (dropped - 1)))
+                log_warn("Event queue full, %u events dropped", dropped);
+            return;
+        }
+    }
+
+    ring[t & TWIN_EVENT_RING_MASK] = *event;
+    atomic_store_explicit(&seq[t & TWIN_EVENT_RING_MASK], t + 1,
+                          memory_order_release);
+    atomic_store_explicit(&tail, t + 1, memory_order_release);
+    _twin_wakeup();
+}
+
+void _twin_run_event(twin_screen_t *screen)
+{
+    unsigned h = atomic_load_explicit(&head, memory_order_relaxed);
+    unsigned t = atomic_load_explicit(&tail, memory_order_acquire);
+    twin_event_t event, next;
+    bool pending = false;
+
+    while (h != t) {
+        /* A slot being rewritten is published again with a wakeup */
+        unsigned published = h + 1;
+        if (!atomic_compare_exchange_strong_explicit(
+                &seq[h & TWIN_EVENT_RING_MASK], &published, h,
+                memory_order_acquire, memory_order_relaxed))
+            break;
+        next = ring[h & TWIN_EVENT_RING_MASK];
+        atomic_store_explicit(&head, ++h, memory_order_release);
+
+        /* Only the last of a run of motion events needs to be delivered */
+        if (pending && !_twin_event_coalesce(&event, &next))
+            twin_screen_dispatch(screen, &event);
+        event = next;
+        pending = true;
+    }
+    if (pending)
+        twin_screen_dispatch(screen, &event);
+}
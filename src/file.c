@@ -0,0 +1,367 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2004 Keith Packard <keithp@keithp.com>
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "twin_private.h"
+
+/*
+ * The main loop sleeps in the kernel until a watched file becomes ready, the
+ * next timeout expires or another thread queues work. On Linux this is built
+ * on epoll, with a timerfd carrying the next deadline and an eventfd carrying
+ * wakeups. Other systems fall back to poll() and a self-pipe.
+ */
+#if defined(__linux__)
+#define TWIN_FILE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#define TWIN_FILE_EPOLL 0
+#include <poll.h>
+#endif
+
+#define TWIN_FILE_EVENTS_MAX 16
+
+static twin_queue_t *head;
+static twin_file_t *graveyard;
+static bool running;
+
+static bool initialized;
+static atomic_bool dispatching;
+static atomic_bool wakeup_pending;
+static pthread_t dispatch_thread;
+
+static twin_wakeup_proc_t wakeup_proc;
+static void *wakeup_closure;
+
+#if TWIN_FILE_EPOLL
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int wakeup_fd = -1;
+#else
+static int wakeup_pipe[2] = {-1, -1};
+static struct pollfd *pfds;
+static twin_file_t **pfiles;
+static int pfds_size;
+#endif
+
+#if TWIN_FILE_EPOLL
+static uint32_t _twin_file_events(twin_file_op_t ops)
+{
+    uint32_t events = 0;
+
+    if (ops & TWIN_READ)
+        events |= EPOLLIN;
+    if (ops & TWIN_WRITE)
+        events |= EPOLLOUT;
+    return events;
+}
+
+static bool _twin_file_init(void)
+{
+    if (initialized)
+        return epoll_fd >= 0;
+    initialized = true;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_error("Failed to create epoll instance");
+        return false;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (timer_fd < 0 || wakeup_fd < 0) {
+        log_error("Failed to create timerfd/eventfd for the main loop");
+        goto bail;
+    }
+
+    /* Internal descriptors are tagged with their own address */
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &timer_fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
+        goto bail;
+    ev.data.ptr = &wakeup_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev) < 0)
+        goto bail;
+    return true;
+
+bail:
+    if (timer_fd >= 0)
+        close(timer_fd);
+    if (wakeup_fd >= 0)
+        close(wakeup_fd);
+    close(epoll_fd);
+    epoll_fd = timer_fd = wakeup_fd = -1;
+    return false;
+}
+
+static void _twin_file_arm_timer(twin_nsec_t deadline)
+{
+    struct itimerspec its = {0};
+
+    /* A zero it_value disarms the timer */
+    if (deadline > 0) {
+        its.it_value.tv_sec = deadline / 1000000000;
+        its.it_value.tv_nsec = deadline % 1000000000;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void _twin_file_drain(int fd)
+{
+    uint64_t count;
+
+    while (read(fd, &count, sizeof(count)) > 0)
+        ;
+}
+#else
+static bool _twin_file_init(void)
+{
+    if (initialized)
+        return wakeup_pipe[0] >= 0;
+    initialized = true;
+
+    if (pipe(wakeup_pipe) < 0) {
+        log_error("Failed to create wakeup pipe for the main loop");
+        wakeup_pipe[0] = wakeup_pipe[1] = -1;
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wakeup_pipe[i], F_SETFL,
+              fcntl(wakeup_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wakeup_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+static void _twin_file_drain(int fd)
+{
+    uint8_t buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+#endif
+
+static void _twin_file_dispatch(twin_file_t *file, twin_file_op_t ops)
+{
+    if (file->queue.deleted || !ops)
+        return;
+    if (!(*file->proc)(file->file, ops, file->closure))
+        twin_clear_file(file);
+}
+
+void _twin_run_file(twin_nsec_t deadline)
+{
+    if (!_twin_file_init()) {
+        /* Without a way to block, at least do not spin on the timeouts */
+        twin_nsec_t delay = deadline - _twin_now_nsec();
+        if (deadline > 0 && delay > 0)
+            usleep(delay / 1000);
+        return;
+    }
+
+    if (!atomic_load(&dispatching)) {
+        dispatch_thread = pthread_self();
+        atomic_store(&dispatching, true);
+    }
+
+    running = true;
+
+#if TWIN_FILE_EPOLL
+    struct epoll_event events[TWIN_FILE_EVENTS_MAX];
+    int n;
+
+    /* The timerfd carries the deadline with full nanosecond resolution */
+    if (deadline > 0)
+        _twin_file_arm_timer(deadline);
+    do {
+        n = epoll_wait(epoll_fd, events, TWIN_FILE_EVENTS_MAX,
+                       deadline == 0 ? 0 : -1);
+    } while (n < 0 && errno == EINTR);
+
+    for (int i = 0; i < n; i++) {
+        void *ptr = events[i].data.ptr;
+        if (ptr == &timer_fd) {
+            _twin_file_drain(timer_fd);
+        } else if (ptr == &wakeup_fd) {
+            atomic_store(&wakeup_pending, false);
+            _twin_file_drain(wakeup_fd);
+        } else {
+            twin_file_op_t ops = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                ops |= TWIN_READ;
+            if (events[i].events & EPOLLOUT)
+                ops |= TWIN_WRITE;
+            _twin_file_dispatch(ptr, ops);
+        }
+    }
+
+    /* Do not leave a stale deadline behind for the next iteration */
+    if (deadline > 0)
+        _twin_file_arm_timer(0);
+#else
+    int nfds = 1;
+    for (twin_queue_t *q = head; q; q = q->next)
+        nfds++;
+    if (nfds > pfds_size) {
+        struct pollfd *np = realloc(pfds, nfds * sizeof(*pfds));
+        twin_file_t **nf = realloc(pfiles, nfds * sizeof(*pfiles));
+        if (np)
+            pfds = np;
+        if (nf)
+            pfiles = nf;
+        if (!np || !nf) {
+            running = false;
+            return;
+        }
+        pfds_size = nfds;
+    }
+
+    pfds[0].fd = wakeup_pipe[0];
+    pfds[0].events = POLLIN;
+    pfiles[0] = NULL;
+    nfds = 1;
+    for (twin_queue_t *q = head; q; q = q->next, nfds++) {
+        twin_file_t *file = (twin_file_t *) q;
+        pfds[nfds].fd = file->file;
+        pfds[nfds].events = ((file->ops & TWIN_READ) ? POLLIN : 0) |
+                            ((file->ops & TWIN_WRITE) ? POLLOUT : 0);
+        pfiles[nfds] = file;
+    }
+
+    int n;
+    do {
+        twin_time_t delay = -1;
+        if (deadline >= 0) {
+            twin_nsec_t left = deadline - _twin_now_nsec();
+            delay = left > 0 ? (left + 999999) / 1000000 : 0;
+        }
+        n = poll(pfds, nfds, delay);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        if (pfds[0].revents & POLLIN) {
+            atomic_store(&wakeup_pending, false);
+            _twin_file_drain(wakeup_pipe[0]);
+        }
+        for (int i = 1; i < nfds; i++) {
+            twin_file_op_t ops = 0;
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                ops |= TWIN_READ;
+            if (pfds[i].revents & POLLOUT)
+                ops |= TWIN_WRITE;
+            _twin_file_dispatch(pfiles[i], ops);
+        }
+    }
+#endif
+
+    running = false;
+    while (graveyard) {
+        twin_file_t *file = graveyard;
+        graveyard = (twin_file_t *) file->queue.next;
+        free(file);
+    }
+}
+
+void _twin_wakeup(void)
+{
+    /* The dispatch thread is awake; work it queues for itself is caught by
+     * _twin_work_pending() before the main loop sleeps again
+     */
+    if (!atomic_load(&dispatching) ||
+        pthread_equal(pthread_self(), dispatch_thread))
+        return;
+
+    /* Coalesce wakeups until the main loop drains the pending one */
+    if (atomic_exchange(&wakeup_pending, true))
+        return;
+
+#if TWIN_FILE_EPOLL
+    uint64_t one = 1;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0)
+        atomic_store(&wakeup_pending, false);
+#else
+    uint8_t one = 1;
+    if (write(wakeup_pipe[1], &one, sizeof(one)) < 0)
+        atomic_store(&wakeup_pending, false);
+#endif
+
+    /* Backends sleeping outside _twin_run_file() need their own nudge */
+    if (wakeup_proc)
+        (*wakeup_proc)(wakeup_closure);
+}
+
+void _twin_set_wakeup(twin_wakeup_proc_t proc, void *closure)
+{
+    wakeup_proc = proc;
+    wakeup_closure = closure;
+}
+
+static twin_order_t _twin_file_order(twin_queue_t *a maybe_unused,
+                                     twin_queue_t *b maybe_unused)
+{
+    return TWIN_AT;
+}
+
+twin_file_t *twin_set_file(twin_file_proc_t file_proc,
+                           int file,
+                           twin_file_op_t ops,
+                           void *closure)
+{
+    if (!_twin_file_init())
+        return NULL;
+
+    twin_file_t *tf = malloc(sizeof(twin_file_t));
+    if (!tf)
+        return NULL;
+
+    tf->file = file;
+    tf->ops = ops;
+    tf->proc = file_proc;
+    tf->closure = closure;
+
+#if TWIN_FILE_EPOLL
+    struct epoll_event ev = {
+        .events = _twin_file_events(ops),
+        .data.ptr = tf,
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, file, &ev) < 0) {
+        log_error("Failed to watch file descriptor %d", file);
+        free(tf);
+        return NULL;
+    }
+#endif
+
+    _twin_queue_insert(&head, _twin_file_order, &tf->queue);
+    return tf;
+}
+
+void twin_clear_file(twin_file_t *file)
+{
+    if (file->queue.deleted)
+        return;
+
+#if TWIN_FILE_EPOLL
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, file->file, NULL);
+#endif
+    _twin_queue_delete(&head, &file->queue);
+
+    /* Pending events of this dispatch round may still refer to the file */
+    if (running) {
+        file->queue.next = (twin_queue_t *) graveyard;
+        graveyard = file;
+    } else {
+        free(file);
+    }
+}
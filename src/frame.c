@@ -0,0 +1,145 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+
+#include "twin_private.h"
+
+/*
+ * The frame clock ticks once per display refresh while any frame proc is
+ * pending, so every animation advances in the same tick and the screen is
+ * composited once per refresh. Backends that can observe the refresh report
+ * it through _twin_frame_vblank(); otherwise a timer running at the nominal
+ * refresh interval stands in for it.
+ */
+
+#define TWIN_FRAME_INTERVAL_DEFAULT (1000000000LL / 60)
+#define TWIN_FRAME_INTERVAL_MIN (1000000000LL / 240)
+#define TWIN_FRAME_INTERVAL_MAX (1000000000LL / 20)
+
+static twin_queue_t *head;
+static twin_timeout_t *fallback;
+
+static twin_nsec_t interval = TWIN_FRAME_INTERVAL_DEFAULT;
+static twin_nsec_t last_vblank;
+
+static twin_vblank_arm_t vblank_arm;
+static void *vblank_closure;
+static bool armed;
+
+static twin_order_t _twin_frame_order(twin_queue_t *a maybe_unused,
+                                      twin_queue_t *b maybe_unused)
+{
+    return TWIN_AT;
+}
+
+static void _twin_frame_arm(bool arm)
+{
+    if (armed == arm)
+        return;
+    armed = arm;
+    if (vblank_arm)
+        (*vblank_arm)(arm, vblank_closure);
+}
+
+static void _twin_frame_tick(twin_nsec_t now)
+{
+    twin_time_t target = (twin_time_t) ((now + interval) / 1000000);
+    twin_queue_t *run = head;
+
+    /* Frames requested from within a frame proc wait for the next tick */
+    head = NULL;
+    for (twin_queue_t *q = run; q; q = q->next)
+        ((twin_frame_t *) q)->pending = true;
+
+    while (run) {
+        twin_frame_t *frame = (twin_frame_t *) run;
+        run = run->next;
+        /* Still pending while its proc runs, so that clearing the frame
+         * from inside only marks it and the free is left to this loop
+         */
+        bool keep = !frame->queue.deleted &&
+                    (*frame->proc)(target, frame->closure) &&
+                    !frame->queue.deleted;
+        frame->pending = false;
+        if (keep)
+            _twin_queue_insert(&head, _twin_frame_order, &frame->queue);
+        else
+            free(frame);
+    }
+
+    if (!head)
+        _twin_frame_arm(false);
+}
+
+static twin_time_t _twin_frame_fallback(twin_time_t now maybe_unused,
+                                        void *closure maybe_unused)
+{
+    twin_nsec_t t = _twin_now_nsec();
+
+    if (!head) {
+        fallback = NULL;
+        return -1;
+    }
+
+    /* Stay out of the way while the backend reports refreshes */
+    if (t - last_vblank > 2 * interval)
+        _twin_frame_tick(t);
+    return (twin_time_t) (interval / 1000000);
+}
+
+void _twin_frame_vblank(twin_nsec_t when)
+{
+    twin_nsec_t delta = when - last_vblank;
+
+    if (delta >= TWIN_FRAME_INTERVAL_MIN && delta <= TWIN_FRAME_INTERVAL_MAX)
+        interval = (interval * 7 + delta) / 8;
+    last_vblank = when;
+
+    if (head)
+        _twin_frame_tick(when);
+}
+
+void _twin_frame_set_vblank(twin_vblank_arm_t arm, void *closure)
+{
+    if (armed && vblank_arm)
+        (*vblank_arm)(false, vblank_closure);
+    vblank_arm = arm;
+    vblank_closure = closure;
+    if (armed && vblank_arm)
+        (*vblank_arm)(true, vblank_closure);
+}
+
+twin_frame_t *twin_set_frame(twin_frame_proc_t frame_proc, void *closure)
+{
+    twin_frame_t *frame = malloc(sizeof(twin_frame_t));
+    if (!frame)
+        return NULL;
+
+    frame->proc = frame_proc;
+    frame->closure = closure;
+    frame->pending = false;
+    _twin_queue_insert(&head, _twin_frame_order, &frame->queue);
+
+    _twin_frame_arm(true);
+    if (!fallback)
+        fallback = twin_set_timeout(_twin_frame_fallback,
+                                    (twin_time_t) (interval / 1000000), NULL);
+    return frame;
+}
+
+void twin_clear_frame(twin_frame_t *frame)
+{
+    /* Frames waiting in the current tick are freed by the tick itself */
+    if (frame->pending) {
+        frame->queue.deleted = true;
+        return;
+    }
+    _twin_queue_delete(&head, &frame->queue);
+    free(frame);
+    if (!head)
+        _twin_frame_arm(false);
+}
@@ -11,6 +11,8 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "twin.h"
@@ -29,9 +31,24 @@ typedef struct {
     int transparency;
 } gif_gce_t;
 
+/* LZW string table; each code extends its prefix code by one byte */
+#define GIF_LZW_CODES 0x1000
+
+typedef struct {
+    uint16_t prefix[GIF_LZW_CODES];
+    uint16_t length[GIF_LZW_CODES];
+    uint8_t suffix[GIF_LZW_CODES];
+} gif_lzw_t;
+
+/*
+ * The whole file is mapped, or read in at once where it cannot be mapped,
+ * and parsed in place; reads past the end yield zeros.
+ */
 typedef struct _twin_gif {
-    int fd;
-    off_t anim_start;
+    const uint8_t *data;
+    size_t size, pos;
+    bool mapped;
+    size_t anim_start;
     twin_coord_t width, height;
     twin_coord_t depth;
     twin_count_t loop_count;
@@ -41,110 +58,161 @@ typedef struct _twin_gif {
     uint16_t fx, fy, fw, fh;
     uint8_t bgindex;
     uint8_t *canvas, *frame;
+    /* Composed RGB of the frame being converted */
+    uint8_t *rgb;
+    gif_lzw_t lzw;
 } twin_gif_t;
 
+/* Frames kept decoded at once; shorter animations end up fully cached */
+#define GIF_FRAME_RING 4
+
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
-#define MAX(A, B) ((A) > (B) ? (A) : (B))
 
-typedef struct {
-    uint16_t length;
-    uint16_t prefix;
-    uint8_t suffix;
-} entry_t;
+static void gif_read(twin_gif_t *gif, void *buf, size_t n)
+{
+    size_t avail = gif->pos < gif->size ? gif->size - gif->pos : 0;
 
-typedef struct {
-    int bulk;
-    int n_entries;
-    entry_t *entries;
-} table_t;
+    if (n > avail) {
+        memset((uint8_t *) buf + avail, 0, n - avail);
+        n = avail;
+    }
+    if (n)
+        memcpy(buf, gif->data + gif->pos, n);
+    gif->pos += n;
+}
 
-static uint16_t read_num(int fd)
+static uint8_t read_byte(twin_gif_t *gif)
 {
-    uint8_t bytes[2];
+    return gif->pos < gif->size ? gif->data[gif->pos++] : 0;
+}
 
-    read(fd, bytes, 2);
-    return bytes[0] + (((uint16_t) bytes[1]) << 8);
+static uint16_t read_num(twin_gif_t *gif)
+{
+    uint8_t lo = read_byte(gif);
+    return lo | (uint16_t) read_byte(gif) << 8;
 }
 
-static twin_gif_t *gif_open(const char *fname)
+static void gif_skip(twin_gif_t *gif, size_t n)
 {
-    uint8_t sigver[3];
-    uint16_t width, height, depth;
-    uint8_t fdsz, bgidx, aspect;
-    int i;
-    uint8_t *bgcolor;
-    int gct_sz;
-    twin_gif_t *gif;
+    gif->pos += n;
+}
 
+/* Return to the first frame with the canvas cleared to the background */
+static void gif_reset(twin_gif_t *gif)
+{
+    int n = gif->width * gif->height;
+    uint8_t *bgcolor = &gif->gct.colors[gif->bgindex * 3];
+
+    gif->pos = gif->anim_start;
+    memset(&gif->gce, 0, sizeof(gif->gce));
+    gif->palette = &gif->gct;
+    gif->fx = gif->fy = gif->fw = gif->fh = 0;
+    memset(gif->frame, gif->bgindex, n);
+    for (int i = 0; i < n; i++)
+        memcpy(&gif->canvas[i * 3], bgcolor, 3);
+}
+
+static bool gif_map(twin_gif_t *gif, const char *fname)
+{
+    struct stat st;
     int fd = open(fname, O_RDONLY);
+
     if (fd == -1)
+        return false;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    gif->size = st.st_size;
+
+    void *p = mmap(NULL, gif->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+        gif->data = p;
+        gif->mapped = true;
+    } else {
+        uint8_t *buf = malloc(gif->size);
+        size_t got = 0;
+        ssize_t n = 1;
+        while (buf && got < gif->size &&
+               (n = read(fd, buf + got, gif->size - got)) > 0)
+            got += n;
+        gif->size = got;
+        gif->data = buf;
+    }
+    close(fd);
+    return gif->data != NULL;
+}
+
+static void gif_unmap(twin_gif_t *gif)
+{
+    if (gif->mapped)
+        munmap((void *) gif->data, gif->size);
+    else
+        free((void *) gif->data);
+}
+
+static twin_gif_t *gif_open(const char *fname)
+{
+    uint8_t sigver[3];
+    uint16_t width, height;
+    uint8_t fdsz;
+    twin_gif_t *gif = calloc(1, sizeof(*gif));
+
+    if (!gif)
+        return NULL;
+    if (!gif_map(gif, fname)) {
+        free(gif);
         return NULL;
-#ifdef _WIN32
-    setmode(fd, O_BINARY);
-#endif
+    }
     /* Header */
-    read(fd, sigver, 3);
+    gif_read(gif, sigver, 3);
     if (memcmp(sigver, "GIF", 3) != 0) {
         log_error("Invalid signature");
         goto fail;
     }
     /* Version */
-    read(fd, sigver, 3);
+    gif_read(gif, sigver, 3);
     if (memcmp(sigver, "89a", 3) != 0) {
         log_error("Invalid version");
         goto fail;
     }
     /* Width x Height */
-    width = read_num(fd);
-    height = read_num(fd);
+    width = read_num(gif);
+    height = read_num(gif);
     /* FDSZ */
-    read(fd, &fdsz, 1);
+    fdsz = read_byte(gif);
     /* Presence of GCT */
     if (!(fdsz & 0x80)) {
         log_error("No global color table");
         goto fail;
     }
+    gif->width = width;
+    gif->height = height;
     /* Color Space's Depth */
-    depth = ((fdsz >> 4) & 7) + 1;
+    gif->depth = ((fdsz >> 4) & 7) + 1;
     /* Ignore Sort Flag. */
     /* GCT Size */
-    gct_sz = 1 << ((fdsz & 0x07) + 1);
+    gif->gct.size = 1 << ((fdsz & 0x07) + 1);
     /* Background Color Index */
-    read(fd, &bgidx, 1);
+    gif->bgindex = read_byte(gif);
     /* Aspect Ratio */
-    read(fd, &aspect, 1);
-    /* Create twin_gif_t Structure. */
-    gif = calloc(1, sizeof(*gif));
-    if (!gif)
-        goto fail;
-    gif->fd = fd;
-    gif->width = width;
-    gif->height = height;
-    gif->depth = depth;
+    gif_skip(gif, 1);
     /* Read GCT */
-    gif->gct.size = gct_sz;
-    read(fd, gif->gct.colors, 3 * gif->gct.size);
+    gif_read(gif, gif->gct.colors, 3 * gif->gct.size);
     gif->palette = &gif->gct;
-    gif->bgindex = bgidx;
-    gif->frame = calloc(4, width * height);
-    if (!gif->frame) {
-        free(gif);
+    gif->frame = calloc(7, width * height);
+    if (!gif->frame)
         goto fail;
-    }
     gif->canvas = &gif->frame[width * height];
-    if (gif->bgindex)
-        memset(gif->frame, gif->bgindex, gif->width * gif->height);
-    bgcolor = &gif->palette->colors[gif->bgindex * 3];
-    if (bgcolor[0] || bgcolor[1] || bgcolor[2])
-        for (i = 0; i < gif->width * gif->height; i++)
-            memcpy(&gif->canvas[i * 3], bgcolor, 3);
-    gif->anim_start = lseek(fd, 0, SEEK_CUR);
-    goto ok;
+    gif->rgb = &gif->canvas[width * height * 3];
+    gif->anim_start = gif->pos;
+    gif_reset(gif);
+    return gif;
+
 fail:
-    close(fd);
+    gif_unmap(gif);
+    free(gif);
     return NULL;
-ok:
-    return gif;
 }
 
 static void discard_sub_blocks(twin_gif_t *gif)
@@ -152,82 +220,9 @@ static void discard_sub_blocks(twin_gif_t *gif)
     uint8_t size;
 
     do {
-        read(gif->fd, &size, 1);
-        lseek(gif->fd, size, SEEK_CUR);
-    } while (size);
-}
-
-static table_t *table_new(int key_size)
-{
-    int init_bulk = MAX(1 << (key_size + 1), 0x100);
-    table_t *table = malloc(sizeof(*table) + sizeof(entry_t) * init_bulk);
-    if (table) {
-        table->bulk = init_bulk;
-        table->n_entries = (1 << key_size) + 2;
-        table->entries = (entry_t *) &table[1];
-        for (int key = 0; key < (1 << key_size); key++)
-            table->entries[key] = (entry_t){1, 0xFFF, key};
-    }
-    return table;
-}
-
-/* Add table entry. Return value:
- *  0 on success
- *  +1 if key size must be incremented after this addition
- *  -1 if could not realloc table
- */
-static int entry_add(table_t **table_p,
-                     uint16_t length,
-                     uint16_t prefix,
-                     uint8_t suffix)
-{
-    table_t *table = *table_p;
-    if (table->n_entries == table->bulk) {
-        table->bulk *= 2;
-        table = realloc(table, sizeof(*table) + sizeof(entry_t) * table->bulk);
-        if (!table)
-            return -1;
-        table->entries = (entry_t *) &table[1];
-        *table_p = table;
-    }
-    table->entries[table->n_entries] = (entry_t){length, prefix, suffix};
-    table->n_entries++;
-    if ((table->n_entries & (table->n_entries - 1)) == 0)
-        return 1;
-    return 0;
-}
-
-static uint16_t get_key(twin_gif_t *gif,
-                        int key_size,
-                        uint8_t *sub_len,
-                        uint8_t *shift,
-                        uint8_t *byte)
-{
-    int bits_read;
-    int rpad;
-    int frag_size;
-    uint16_t key;
-
-    key = 0;
-    for (bits_read = 0; bits_read < key_size; bits_read += frag_size) {
-        rpad = (*shift + bits_read) % 8;
-        if (rpad == 0) {
-            /* Update byte. */
-            if (*sub_len == 0) {
-                read(gif->fd, sub_len, 1); /* Must be nonzero! */
-                if (*sub_len == 0)
-                    return 0x1000;
-            }
-            read(gif->fd, byte, 1);
-            (*sub_len)--;
-        }
-        frag_size = MIN(key_size - bits_read, 8 - rpad);
-        key |= ((uint16_t) ((*byte) >> rpad)) << bits_read;
-    }
-    /* Clear extra bits to the left. */
-    key &= (1 << key_size) - 1;
-    *shift = (*shift + key_size) % 8;
-    return key;
+        size = read_byte(gif);
+        gif_skip(gif, size);
+    } while (size && gif->pos < gif->size);
 }
 
 /* Compute output index of y-th input line, in frame of height h. */
@@ -251,92 +246,148 @@ static int interlaced_line_index(int h, int y)
     return y * 2 + 1;
 }
 
-/* Decompress image pixels.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table_t).
+/* Store 'len' decoded pixels starting at offset 'off' of the frame rect */
+static void gif_put_run(twin_gif_t *gif,
+                        int interlace,
+                        int off,
+                        const uint8_t *run,
+                        int len)
+{
+    while (len > 0) {
+        int x = off % gif->fw, y = off / gif->fw;
+        int n = MIN(len, gif->fw - x);
+        if (interlace)
+            y = interlaced_line_index((int) gif->fh, y);
+        memcpy(&gif->frame[(gif->fy + y) * gif->width + gif->fx + x], run, n);
+        run += n;
+        off += n;
+        len -= n;
+    }
+}
+
+/*
+ * Decompress image pixels.
+ *
+ * Every code of the LZW table extends its prefix by one byte, so a string
+ * is produced back to front by following prefixes. A string that stays on
+ * one row of the frame is written straight into it; only strings wrapping
+ * onto another row go through a bounce buffer.
+ * Return 0 on success or -1 on malformed data.
  */
 static int read_image_data(twin_gif_t *gif, int interlace)
 {
-    uint8_t sub_len, shift, byte;
-    int init_key_size, key_size;
-    bool is_table_full = false;
-    int frm_off, frm_size, str_len = 0, i, p, x, y;
-    uint16_t key, clear, stop;
-    int ret;
-    table_t *table;
-    entry_t entry = {0};
-    off_t start, end;
-
-    read(gif->fd, &byte, 1);
-    key_size = (int) byte;
-    if (key_size < 2 || key_size > 8)
+    gif_lzw_t *lzw = &gif->lzw;
+    uint8_t bounce[GIF_LZW_CODES];
+    int min_size = read_byte(gif);
+
+    if (min_size < 2 || min_size > 8)
         return -1;
 
-    start = lseek(gif->fd, 0, SEEK_CUR);
+    /* The sub-blocks are parsed in place; find where they end first */
+    size_t start = gif->pos;
     discard_sub_blocks(gif);
-    end = lseek(gif->fd, 0, SEEK_CUR);
-    lseek(gif->fd, start, SEEK_SET);
-    clear = 1 << key_size;
-    stop = clear + 1;
-    table = table_new(key_size);
-    key_size++;
-    init_key_size = key_size;
-    sub_len = shift = 0;
-    key = get_key(gif, key_size, &sub_len, &shift, &byte); /* clear code */
-    frm_off = 0;
-    ret = 0;
-    frm_size = gif->fw * gif->fh;
-    while (frm_off < frm_size) {
-        if (key == clear) {
-            key_size = init_key_size;
-            table->n_entries = (1 << (key_size - 1)) + 2;
-            is_table_full = false;
-        } else if (!is_table_full) {
-            ret = entry_add(&table, str_len + 1, key, entry.suffix);
-            if (ret == -1) {
-                free(table);
-                return -1;
-            }
-            if (table->n_entries == 0x1000) {
-                ret = 0;
-                is_table_full = true;
+    size_t end = MIN(gif->pos, gif->size);
+    const uint8_t *in = gif->data + start;
+    const uint8_t *in_end = gif->data + end;
+    int block = 0;
+
+    int clear = 1 << min_size, stop = clear + 1;
+    int code_size = min_size + 1, avail = clear + 2;
+    int old = -1, first = 0;
+    uint32_t bits = 0;
+    int n_bits = 0;
+    int off = 0, frm_size = gif->fw * gif->fh;
+
+    for (int i = 0; i < clear; i++) {
+        lzw->suffix[i] = i;
+        lzw->length[i] = 1;
+    }
+
+    while (off < frm_size) {
+        /* Refill the bit buffer a byte at a time across sub-blocks */
+        while (n_bits < code_size) {
+            if (!block) {
+                if (in >= in_end || !(block = *in++))
+                    goto done;
             }
+            if (in >= in_end)
+                goto done;
+            bits |= (uint32_t) *in++ << n_bits;
+            n_bits += 8;
+            block--;
         }
-        key = get_key(gif, key_size, &sub_len, &shift, &byte);
-        if (key == clear)
+        int code = bits & ((1 << code_size) - 1);
+        bits >>= code_size;
+        n_bits -= code_size;
+
+        if (code == clear) {
+            code_size = min_size + 1;
+            avail = clear + 2;
+            old = -1;
             continue;
-        if (key == stop || key == 0x1000)
-            break;
-        if (key >= table->n_entries)
+        }
+        if (code == stop)
             break;
-        if (ret == 1)
-            key_size++;
-        entry = table->entries[key];
-        str_len = entry.length;
-        for (i = 0; i < str_len; i++) {
-            p = frm_off + entry.length - 1;
-            x = p % gif->fw;
-            y = p / gif->fw;
-            if (interlace)
-                y = interlaced_line_index((int) gif->fh, y);
-            gif->frame[(gif->fy + y) * gif->width + gif->fx + x] = entry.suffix;
-            if (entry.prefix == 0xFFF || entry.prefix >= table->n_entries)
+        if (old < 0) {
+            if (code > clear)
                 break;
-            else
-                entry = table->entries[entry.prefix];
+            uint8_t pixel = code;
+            gif_put_run(gif, interlace, off++, &pixel, 1);
+            old = first = code;
+            continue;
+        }
+        if (code > avail)
+            break;
+
+        /* A code not in the table yet is the previous string plus its
+         * own first byte
+         */
+        int len, c = code;
+        if (code == avail) {
+            len = lzw->length[old] + 1;
+            c = old;
+        } else {
+            len = lzw->length[code];
+        }
+        int n = MIN(len, frm_size - off);
+        int x = off % gif->fw;
+        bool direct = !interlace && n == len && x + len <= gif->fw;
+        uint8_t *dst =
+            direct ? &gif->frame[(gif->fy + off / gif->fw) * gif->width +
+                                 gif->fx + x]
+                   : bounce;
+
+        uint8_t *p = dst + len - 1;
+        if (code == avail)
+            *p-- = first;
+        while (c >= clear) {
+            *p-- = lzw->suffix[c];
+            c = lzw->prefix[c];
+        }
+        *p = c;
+        first = c;
+
+        if (!direct)
+            gif_put_run(gif, interlace, off, bounce, n);
+        off += n;
+
+        if (avail < GIF_LZW_CODES) {
+            lzw->prefix[avail] = old;
+            lzw->suffix[avail] = first;
+            lzw->length[avail] = lzw->length[old] + 1;
+            avail++;
+            if (avail == (1 << code_size) && code_size < 12)
+                code_size++;
         }
-        frm_off += str_len;
-        if (key < table->n_entries - 1 && !is_table_full)
-            table->entries[table->n_entries - 1].suffix = entry.suffix;
+        old = code;
     }
-    free(table);
-    if (key == stop)
-        read(gif->fd, &sub_len, 1); /* Must be zero! */
-    lseek(gif->fd, end, SEEK_SET);
+done:
+    gif->pos = end;
     return 0;
 }
 
 /* Read image.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table_t).
+ * Return 0 on success or -1 on malformed data.
  */
 static int read_image(twin_gif_t *gif)
 {
@@ -344,26 +395,26 @@ static int read_image(twin_gif_t *gif)
     int interlace;
 
     /* Image Descriptor. */
-    gif->fx = read_num(gif->fd);
-    gif->fy = read_num(gif->fd);
+    gif->fx = read_num(gif);
+    gif->fy = read_num(gif);
 
     if (gif->fx >= gif->width || gif->fy >= gif->height)
         return -1;
 
-    gif->fw = read_num(gif->fd);
-    gif->fh = read_num(gif->fd);
+    gif->fw = read_num(gif);
+    gif->fh = read_num(gif);
 
     gif->fw = MIN(gif->fw, gif->width - gif->fx);
     gif->fh = MIN(gif->fh, gif->height - gif->fy);
 
-    read(gif->fd, &fisrz, 1);
+    fisrz = read_byte(gif);
     interlace = fisrz & 0x40;
     /* Ignore Sort Flag. */
-    /* Local Color table_t? */
+    /* Local Color Table? */
     if (fisrz & 0x80) {
         /* Read LCT */
         gif->lct.size = 1 << ((fisrz & 0x07) + 1);
-        read(gif->fd, gif->lct.colors, 3 * gif->lct.size);
+        gif_read(gif, gif->lct.colors, 3 * gif->lct.size);
         gif->palette = &gif->lct;
     } else
         gif->palette = &gif->gct;
@@ -412,7 +463,7 @@ static void dispose(twin_gif_t *gif)
 static void read_plain_text_ext(twin_gif_t *gif)
 {
     /* Discard plain text metadata. */
-    lseek(gif->fd, 13, SEEK_CUR);
+    gif_skip(gif, 13);
     /* Discard plain text sub-blocks. */
     discard_sub_blocks(gif);
 }
@@ -422,15 +473,15 @@ static void read_graphic_control_ext(twin_gif_t *gif)
     uint8_t rdit;
 
     /* Discard block size (always 0x04). */
-    lseek(gif->fd, 1, SEEK_CUR);
-    read(gif->fd, &rdit, 1);
+    gif_skip(gif, 1);
+    rdit = read_byte(gif);
     gif->gce.disposal = (rdit >> 2) & 3;
     gif->gce.input = rdit & 2;
     gif->gce.transparency = rdit & 1;
-    gif->gce.delay = read_num(gif->fd);
-    read(gif->fd, &gif->gce.tindex, 1);
+    gif->gce.delay = read_num(gif);
+    gif->gce.tindex = read_byte(gif);
     /* Skip block terminator. */
-    lseek(gif->fd, 1, SEEK_CUR);
+    gif_skip(gif, 1);
 }
 
 static void read_comment_ext(twin_gif_t *gif)
@@ -445,17 +496,17 @@ static void read_application_ext(twin_gif_t *gif)
     char app_auth_code[3];
 
     /* Discard block size (always 0x0B). */
-    lseek(gif->fd, 1, SEEK_CUR);
+    gif_skip(gif, 1);
     /* Application Identifier. */
-    read(gif->fd, app_id, 8);
+    gif_read(gif, (uint8_t *) app_id, 8);
     /* Application Authentication Code. */
-    read(gif->fd, app_auth_code, 3);
+    gif_read(gif, (uint8_t *) app_auth_code, 3);
     if (!strncmp(app_id, "NETSCAPE", sizeof(app_id))) {
         /* Discard block size (0x03) and constant byte (0x01). */
-        lseek(gif->fd, 2, SEEK_CUR);
-        gif->loop_count = read_num(gif->fd);
+        gif_skip(gif, 2);
+        gif->loop_count = read_num(gif);
         /* Skip block terminator. */
-        lseek(gif->fd, 1, SEEK_CUR);
+        gif_skip(gif, 1);
     } else {
         discard_sub_blocks(gif);
     }
@@ -465,8 +516,9 @@ static void read_ext(twin_gif_t *gif)
 {
     uint8_t label;
 
-    if (read(gif->fd, &label, 1) < 1)
+    if (gif->pos >= gif->size)
         return;
+    label = read_byte(gif);
     switch (label) {
     case 0x01:
         read_plain_text_ext(gif);
@@ -491,15 +543,15 @@ static int gif_get_frame(twin_gif_t *gif)
     char sep;
 
     dispose(gif);
-    read(gif->fd, &sep, 1);
+    /* Past the end reads as 0, which is no valid separator */
+    sep = read_byte(gif);
     while (sep != ',') {
         if (sep == ';')
             return 0;
         if (sep != '!')
             return -1;
         read_ext(gif);
-        if (read(gif->fd, &sep, 1) < 1)
-            return -1;
+        sep = read_byte(gif);
     }
     if (read_image(gif) == -1)
         return -1;
@@ -517,21 +569,59 @@ static int gif_is_bgcolor(const twin_gif_t *gif, const uint8_t *color)
     return !memcmp(&gif->palette->colors[gif->bgindex * 3], color, 3);
 }
 
-static void gif_rewind(twin_gif_t *gif)
-{
-    lseek(gif->fd, gif->anim_start, SEEK_SET);
-}
-
 static void gif_close(twin_gif_t *gif)
 {
-    close(gif->fd);
+    gif_unmap(gif);
     free(gif->frame);
     free(gif);
 }
 
+static bool _twin_gif_next(void *closure,
+                           twin_pixmap_t *frame,
+                           twin_time_t *delay)
+{
+    twin_gif_t *gif = closure;
+
+    if (gif_get_frame(gif) != 1)
+        return false;
+
+    gif_render_frame(gif, gif->rgb);
+    const uint8_t *color = gif->rgb;
+    for (twin_coord_t row = 0; row < gif->height; row++) {
+        twin_argb32_t *p = twin_pixmap_pointer(frame, 0, row).argb32;
+        for (twin_coord_t col = 0; col < gif->width; col++, color += 3) {
+            uint8_t r = color[0], g = color[1], b = color[2];
+            if (!gif_is_bgcolor(gif, color))
+                *p++ = 0xFF000000U | (r << 16) | (g << 8) | b;
+            /* Construct background */
+            else if (((row >> 3) + (col >> 3)) & 1)
+                *p++ = 0xFFAFAFAFU;
+            else
+                *p++ = 0xFF7F7F7FU;
+        }
+    }
+    /* GIF delay in units of 1/100 second */
+    *delay = gif->gce.delay * 10;
+    return true;
+}
+
+static void _twin_gif_rewind(void *closure)
+{
+    gif_reset(closure);
+}
+
+static void _twin_gif_close(void *closure)
+{
+    gif_close(closure);
+}
+
+/*
+ * Frames are decoded as the animation plays rather than all up front, so
+ * only the first one is ready when the animation is returned.
+ */
 static twin_animation_t *_twin_animation_from_gif_file(const char *path)
 {
-    twin_animation_t *anim = malloc(sizeof(twin_animation_t));
+    twin_animation_t *anim = calloc(1, sizeof(twin_animation_t));
     if (!anim)
         return NULL;
 
@@ -541,73 +631,35 @@ static twin_animation_t *_twin_animation_from_gif_file(const char *path)
         return NULL;
     }
 
-    anim->n_frames = 0;
-    anim->frames = NULL;
-    anim->frame_delays = NULL;
     anim->loop = gif->loop_count == 0;
     anim->width = gif->width;
     anim->height = gif->height;
-
-    int frame_count = 0;
-    while (gif_get_frame(gif))
-        frame_count++;
-
-    anim->n_frames = frame_count;
-    anim->frames = malloc(sizeof(twin_pixmap_t *) * frame_count);
-    anim->frame_delays = malloc(sizeof(twin_time_t) * frame_count);
-
-    gif_rewind(gif);
-    uint8_t *color, *frame;
-    frame = malloc(gif->width * gif->height * 3);
-    if (!frame) {
-        free(anim);
+    anim->frames = calloc(GIF_FRAME_RING, sizeof(twin_pixmap_t *));
+    anim->frame_delays = calloc(GIF_FRAME_RING, sizeof(twin_time_t));
+    anim->decoder = malloc(sizeof(twin_animation_decoder_t));
+    if (!anim->frames || !anim->frame_delays || !anim->decoder) {
         gif_close(gif);
+        free(anim->decoder);
+        anim->decoder = NULL;
+        twin_animation_destroy(anim);
         return NULL;
     }
-    for (twin_count_t i = 0; i < frame_count; i++) {
-        anim->frames[i] =
-            twin_pixmap_create(TWIN_ARGB32, gif->width, gif->height);
-        if (!anim->frames[i]) {
-            free(anim);
-            gif_close(gif);
-            return NULL;
-        }
-        anim->frames[i]->format = TWIN_ARGB32;
-
-        gif_render_frame(gif, frame);
-        color = frame;
-        twin_pointer_t p = twin_pixmap_pointer(anim->frames[i], 0, 0);
-        twin_coord_t row = 0, col = 0;
-        for (int j = 0; j < gif->width * gif->height; j++) {
-            uint8_t r = color[0], g = color[1], b = color[2];
-            if (!gif_is_bgcolor(gif, color))
-                *(p.argb32++) = 0xFF000000U | (r << 16) | (g << 8) | b;
-            /* Construct background */
-            else if (((row >> 3) + (col >> 3)) & 1)
-                *(p.argb32++) = 0xFFAFAFAFU;
-            else
-                *(p.argb32++) = 0xFF7F7F7FU;
-            col++;
-            if (col == gif->width) {
-                row++;
-                col = 0;
-            }
-            /* next palette */
-            color += 3;
-        }
-        /* GIF delay in units of 1/100 second */
-        anim->frame_delays[i] = gif->gce.delay * 10;
-        gif_get_frame(gif);
-    }
-    anim->iter = twin_animation_iter_init(anim);
-    if (!anim->iter) {
-        free(frame);
-        free(anim);
-        gif_close(gif);
+    anim->n_frames = GIF_FRAME_RING;
+    *anim->decoder = (twin_animation_decoder_t){
+        .next = _twin_gif_next,
+        .rewind = _twin_gif_rewind,
+        .close = _twin_gif_close,
+        .closure = gif,
+    };
+
+    anim->frames[0] = twin_pixmap_create(TWIN_ARGB32, gif->width, gif->height);
+    if (!anim->frames[0] ||
+        !_twin_gif_next(gif, anim->frames[0], &anim->frame_delays[0]) ||
+        !twin_animation_iter_init(anim)) {
+        twin_animation_destroy(anim);
         return NULL;
     }
-    free(frame);
-    gif_close(gif);
+    anim->decoded = 1;
     return anim;
 }
 
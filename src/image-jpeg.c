@@ -41,7 +41,15 @@ static void twin_jpeg_error_exit(j_common_ptr cinfo)
     longjmp(jerr->jbuf, 1);
 }
 
-twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
+/*
+ * Decode 'filepath', letting the IDCT shrink the image towards width x
+ * height. The result is never smaller than the target, so the caller can
+ * finish with a filtered resample; zero dimensions decode at full size.
+ */
+twin_pixmap_t *_twin_jpeg_to_pixmap_scale(const char *filepath,
+                                          twin_format_t fmt,
+                                          twin_coord_t width,
+                                          twin_coord_t height)
 {
     twin_pixmap_t *pix = NULL;
 
@@ -75,12 +83,28 @@ twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
     (void) jpeg_read_header(&cinfo, true);
 
     /* Configure */
-    twin_coord_t width = cinfo.image_width, height = cinfo.image_height;
     if (fmt == TWIN_ARGB32)
         cinfo.out_color_space = JCS_RGB;
     else
         cinfo.out_color_space = JCS_GRAYSCALE;
 
+    /* Pick the smallest scale of N/8 still covering the target. Decoders
+     * supporting fewer scales round up to the next one they have.
+     */
+    if (width > 0 && height > 0) {
+        cinfo.scale_denom = 8;
+        for (cinfo.scale_num = 1; cinfo.scale_num < 8; cinfo.scale_num++) {
+            if ((cinfo.image_width * cinfo.scale_num + 7) / 8 >=
+                    (unsigned) width &&
+                (cinfo.image_height * cinfo.scale_num + 7) / 8 >=
+                    (unsigned) height)
+                break;
+        }
+    }
+    jpeg_calc_output_dimensions(&cinfo);
+    width = cinfo.output_width;
+    height = cinfo.output_height;
+
     /* Allocate pixmap */
     pix = twin_pixmap_create(fmt, width, height);
     if (!pix)
@@ -104,7 +128,7 @@ twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
         twin_pointer_t p = twin_pixmap_pointer(pix, 0, cinfo.output_scanline);
         (void) jpeg_read_scanlines(&cinfo, rowbuf, 1);
         if (fmt == TWIN_A8 || cinfo.output_components == 4)
-            memcpy(p.a8, rowbuf, rowstride);
+            memcpy(p.a8, *rowbuf, rowstride);
         else {
             JSAMPLE *s = *rowbuf;
             for (int i = 0; i < width; i++) {
@@ -123,3 +147,8 @@ twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
 
     return pix;
 }
+
+twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
+{
+    return _twin_jpeg_to_pixmap_scale(filepath, fmt, 0, 0);
+}
@@ -23,34 +23,68 @@ static void _twin_png_read(png_structp png, png_bytep data, png_size_t size)
         png_error(png, "end of file !\n");
 }
 
-/* FIXME: Utilize pixman or similar accelerated routine to convert */
-#if defined(__APPLE__)
-static void _convertBGRtoARGB(uint8_t *data, int width, int height)
+/* How the rows libpng produces become pixmap rows */
+typedef enum {
+    PNG_ROW_DIRECT,      /* already in pixmap format */
+    PNG_ROW_PREMULTIPLY, /* ARGB32 with straight alpha, fixed in place */
+    PNG_ROW_RGB16,       /* RGB or RGBA bytes packed to 565 */
+    PNG_ROW_ALPHA,       /* gray and alpha bytes, keeping the alpha */
+} twin_png_row_t;
+
+static void _twin_png_store_row(twin_pixmap_t *pix,
+                                twin_coord_t y,
+                                const uint8_t *row,
+                                int channels,
+                                twin_png_row_t mode)
 {
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int index = (y * width + x) * 4;
-            uint8_t b = data[index];
-            uint8_t g = data[index + 1];
-            uint8_t r = data[index + 2];
-            data[index] = 255; /* Alpha */
-            data[index + 1] = r;
-            data[index + 2] = g;
-            data[index + 3] = b;
+    twin_pointer_t p = twin_pixmap_pointer(pix, 0, y);
+    uint16_t t1, t2, t3;
+
+    switch (mode) {
+    case PNG_ROW_DIRECT:
+        break;
+    case PNG_ROW_PREMULTIPLY:
+        for (twin_coord_t x = 0; x < pix->width; x++) {
+            twin_argb32_t v = p.argb32[x];
+            uint16_t a = v >> 24;
+            if (a == 0xff)
+                continue;
+            p.argb32[x] = (twin_argb32_t) a << 24 |
+                          twin_int_mult(twin_get_8(v, 16), a, t1) << 16 |
+                          twin_int_mult(twin_get_8(v, 8), a, t2) << 8 |
+                          twin_int_mult(twin_get_8(v, 0), a, t3);
         }
+        break;
+    case PNG_ROW_RGB16:
+        /* Without an alpha channel of its own, the image lands on black */
+        for (twin_coord_t x = 0; x < pix->width; x++, row += channels) {
+            uint16_t a = channels == 4 ? row[3] : 0xff;
+            twin_argb32_t v = twin_int_mult(row[0], a, t1) << 16 |
+                              twin_int_mult(row[1], a, t2) << 8 |
+                              twin_int_mult(row[2], a, t3);
+            p.rgb16[x] = twin_argb32_to_rgb16(v);
+        }
+        break;
+    case PNG_ROW_ALPHA:
+        for (twin_coord_t x = 0; x < pix->width; x++)
+            p.a8[x] = row[x * 2 + 1];
+        break;
     }
 }
-#endif
 
+/*
+ * Decode straight into the pixmap: libpng is set up to produce its native
+ * layout where it can, and each row is finished while it is still in cache.
+ * Only formats libpng cannot produce directly go through a scratch row.
+ */
 twin_pixmap_t *_twin_png_to_pixmap(const char *filepath, twin_format_t fmt)
 {
     uint8_t signature[8];
-    int rb = 0;
     png_structp png = NULL;
     png_infop info = NULL;
-    twin_pixmap_t *pix = NULL;
+    twin_pixmap_t *volatile pix = NULL;
     int depth, ctype, interlace;
-    png_bytep *rowp = NULL;
+    uint8_t *volatile scratch = NULL;
 
     int fd = open(filepath, O_RDONLY);
     if (fd < 0)
@@ -91,58 +125,77 @@ twin_pixmap_t *_twin_png_to_pixmap(const char *filepath, twin_format_t fmt)
         png_set_palette_to_rgb(png);
     if (ctype == PNG_COLOR_TYPE_GRAY && depth < 8)
         png_set_expand_gray_1_2_4_to_8(png);
+
+    bool alpha = (ctype & PNG_COLOR_MASK_ALPHA) ||
+                 png_get_valid(png, info, PNG_INFO_tRNS);
+    bool color = ctype & PNG_COLOR_MASK_COLOR;
     if (png_get_valid(png, info, PNG_INFO_tRNS))
         png_set_tRNS_to_alpha(png);
 
-    png_get_IHDR(png, info, &width, &height, &depth, &ctype, &interlace, NULL,
-                 NULL);
-
+    twin_png_row_t mode = PNG_ROW_DIRECT;
     switch (fmt) {
     case TWIN_A8:
-        if (ctype != PNG_COLOR_TYPE_GRAY || depth != 8)
-            goto bail_free;
-        rb = width;
+        /* Coverage comes from the alpha channel, else from the gray level */
+        if (color)
+            png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+        if (alpha)
+            mode = PNG_ROW_ALPHA;
         break;
     case TWIN_RGB16:
-        /* unsupported for now */
-        goto bail_free;
+        if (!color)
+            png_set_gray_to_rgb(png);
+        mode = PNG_ROW_RGB16;
+        break;
     case TWIN_ARGB32:
-        png_set_filler(png, 0xff, PNG_FILLER_AFTER);
-        if (ctype == PNG_COLOR_TYPE_GRAY || ctype == PNG_COLOR_TYPE_GRAY_ALPHA)
+        if (!color)
             png_set_gray_to_rgb(png);
-
-        png_get_IHDR(png, info, &width, &height, &depth, &ctype, &interlace,
-                     NULL, NULL);
-
-        if (depth != 8)
-            goto bail_free;
-        rb = width * 4;
+#if __BYTE_ORDER == __BIG_ENDIAN
+        png_set_swap_alpha(png);
+        png_set_filler(png, 0xff, PNG_FILLER_BEFORE);
+#else
+        png_set_bgr(png);
+        png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+#endif
+        if (alpha)
+            mode = PNG_ROW_PREMULTIPLY;
         break;
     }
 
-    rowp = malloc(height * sizeof(png_bytep));
-    if (!rowp)
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    if (png_get_bit_depth(png, info) != 8)
         goto bail_free;
+    int channels = png_get_channels(png, info);
+    size_t rowbytes = png_get_rowbytes(png, info);
+
     pix = twin_pixmap_create(fmt, width, height);
     if (!pix)
         goto bail_free;
-    for (size_t i = 0; i < height; i++)
-        rowp[i] = pix->p.b + rb * i;
+    if (mode == PNG_ROW_RGB16 || mode == PNG_ROW_ALPHA) {
+        /* Interlaced rows are only complete after the last pass */
+        scratch = malloc(rowbytes * (passes > 1 ? height : 1));
+        if (!scratch) {
+            twin_pixmap_destroy(pix);
+            pix = NULL;
+            goto bail_free;
+        }
+    }
 
-    png_read_image(png, rowp);
+    for (int pass = 0; pass < passes; pass++) {
+        for (png_uint_32 y = 0; y < height; y++) {
+            uint8_t *row = twin_pixmap_pointer(pix, 0, y).b;
+            if (scratch)
+                row = scratch + (passes > 1 ? y * rowbytes : 0);
+            png_read_row(png, row, NULL);
+            if (pass == passes - 1)
+                _twin_png_store_row(pix, y, row, channels, mode);
+        }
+    }
 
     png_read_end(png, NULL);
 
-    if (fmt == TWIN_ARGB32) {
-        /* Convert from BGR to ARGB if necessary */
-#if defined(__APPLE__)
-        _convertBGRtoARGB(pix->p.b, width, height);
-#endif
-        twin_premultiply_alpha(pix);
-    }
-
 bail_free:
-    free(rowp);
+    free(scratch);
     png_destroy_read_struct(&png, &info, NULL);
 bail_close:
     close(fd);
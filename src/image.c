@@ -4,8 +4,11 @@
  * All rights reserved.
  */
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 
 #include "twin_private.h"
 
@@ -25,6 +28,11 @@
 #define CONFIG_LOADER_TVG 0
 #endif
 
+/* Image cache budget in KiB */
+#if !defined(CONFIG_IMAGE_CACHE_SIZE)
+#define CONFIG_IMAGE_CACHE_SIZE 8192
+#endif
+
 /* Feature test macro */
 #define LOADER_HAS(x) CONFIG_LOADER_##x
 
@@ -118,6 +126,13 @@ static twin_image_format_t image_type_detect(const char *path)
 SUPPORTED_FORMATS
 #undef _
 
+#if LOADER_HAS(JPEG)
+twin_pixmap_t *_twin_jpeg_to_pixmap_scale(const char *filepath,
+                                          twin_format_t fmt,
+                                          twin_coord_t width,
+                                          twin_coord_t height);
+#endif
+
 typedef twin_pixmap_t *(*loader_func_t)(const char *, twin_format_t);
 
 /* clang-format off */
@@ -129,10 +144,459 @@ static loader_func_t image_loaders[] = {
 };
 /* clang-format on */
 
-twin_pixmap_t *twin_pixmap_from_file(const char *path, twin_format_t fmt)
+#define RESAMPLE_SHIFT 14
+#define RESAMPLE_ONE (1 << RESAMPLE_SHIFT)
+
+/* Source pixels contributing to each output pixel along one axis */
+typedef struct {
+    int taps;
+    int *first, *count;
+    /* 'taps' weights per output pixel, each set summing to RESAMPLE_ONE */
+    int *weight;
+} resample_axis_t;
+
+static void resample_axis_fini(resample_axis_t *ax)
+{
+    free(ax->first);
+    free(ax->weight);
+}
+
+static bool resample_axis_init(resample_axis_t *ax, int src, int dst)
+{
+    ax->taps = dst < src ? (src + dst - 1) / dst + 1 : 2;
+    ax->first = malloc(2 * dst * sizeof(int));
+    ax->weight = calloc((size_t) dst * ax->taps, sizeof(int));
+    if (!ax->first || !ax->weight) {
+        resample_axis_fini(ax);
+        return false;
+    }
+    ax->count = ax->first + dst;
+
+    for (int i = 0; i < dst; i++) {
+        int *w = &ax->weight[i * ax->taps];
+        if (dst < src) {
+            /* Shrinking: average the source pixels the output one covers,
+             * measured in units where a source pixel spans 'dst' and an
+             * output pixel 'src'
+             */
+            int64_t lo = (int64_t) i * src, hi = lo + src;
+            int first = lo / dst, last = (hi - 1) / dst, sum = 0;
+            for (int j = first; j <= last; j++) {
+                int64_t a = (int64_t) j * dst, b = a + dst;
+                if (a < lo)
+                    a = lo;
+                if (b > hi)
+                    b = hi;
+                w[j - first] = (b - a) * RESAMPLE_ONE / src;
+                sum += w[j - first];
+            }
+            w[0] += RESAMPLE_ONE - sum;
+            ax->first[i] = first;
+            ax->count[i] = last - first + 1;
+        } else {
+            /* Growing: interpolate between the two nearest pixel centers */
+            int64_t pos =
+                (2 * i + 1) * (int64_t) src * RESAMPLE_ONE / (2 * dst) -
+                RESAMPLE_ONE / 2;
+            if (pos < 0)
+                pos = 0;
+            int first = pos >> RESAMPLE_SHIFT;
+            int frac = pos & (RESAMPLE_ONE - 1);
+            if (first >= src - 1) {
+                first = src - 1;
+                frac = 0;
+            }
+            w[0] = RESAMPLE_ONE - frac;
+            w[1] = frac;
+            ax->first[i] = first;
+            ax->count[i] = frac ? 2 : 1;
+        }
+    }
+    return true;
+}
+
+/*
+ * Resample 8-bit channels with a separable filter: each source row is
+ * filtered horizontally once, then output rows combine those. Averaging
+ * premultiplied channels independently keeps ARGB32 valid.
+ */
+static bool image_resample(twin_pixmap_t *dst, twin_pixmap_t *src, int bpp)
+{
+    resample_axis_t hx, vy;
+    int row = dst->width * bpp;
+
+    if (!resample_axis_init(&hx, src->width, dst->width))
+        return false;
+    if (!resample_axis_init(&vy, src->height, dst->height)) {
+        resample_axis_fini(&hx);
+        return false;
+    }
+    uint8_t *tmp = malloc((size_t) row * src->height);
+    if (!tmp) {
+        resample_axis_fini(&hx);
+        resample_axis_fini(&vy);
+        return false;
+    }
+
+    for (twin_coord_t y = 0; y < src->height; y++) {
+        const uint8_t *s = twin_pixmap_pointer(src, 0, y).a8;
+        uint8_t *d = tmp + y * row;
+        for (twin_coord_t x = 0; x < dst->width; x++) {
+            const int *w = &hx.weight[x * hx.taps];
+            const uint8_t *sp = s + hx.first[x] * bpp;
+            for (int c = 0; c < bpp; c++) {
+                int acc = RESAMPLE_ONE / 2;
+                for (int k = 0; k < hx.count[x]; k++)
+                    acc += sp[k * bpp + c] * w[k];
+                *d++ = acc >> RESAMPLE_SHIFT;
+            }
+        }
+    }
+
+    for (twin_coord_t y = 0; y < dst->height; y++) {
+        const int *w = &vy.weight[y * vy.taps];
+        const uint8_t *s = tmp + vy.first[y] * row;
+        uint8_t *d = twin_pixmap_pointer(dst, 0, y).a8;
+        for (int i = 0; i < row; i++) {
+            int acc = RESAMPLE_ONE / 2;
+            for (int k = 0; k < vy.count[y]; k++)
+                acc += s[k * row + i] * w[k];
+            d[i] = acc >> RESAMPLE_SHIFT;
+        }
+    }
+
+    free(tmp);
+    resample_axis_fini(&hx);
+    resample_axis_fini(&vy);
+    return true;
+}
+
+/* Decode 'path', resampled to width x height unless either is zero */
+static twin_pixmap_t *image_decode(const char *path,
+                                   twin_format_t fmt,
+                                   twin_coord_t width,
+                                   twin_coord_t height)
+{
+    twin_image_format_t type = image_type_detect(path);
+    twin_pixmap_t *src;
+
+#if LOADER_HAS(JPEG)
+    if (type == IMAGE_TYPE_jpeg)
+        src = _twin_jpeg_to_pixmap_scale(path, fmt, width, height);
+    else
+#endif
+        src = image_loaders[type] ? image_loaders[type](path, fmt) : NULL;
+
+    /* Animations keep their own frames and are left at their size */
+    if (!src || width <= 0 || height <= 0 || src->animation ||
+        (src->width == width && src->height == height))
+        return src;
+
+    twin_pixmap_t *dst = twin_pixmap_create(src->format, width, height);
+    if (!dst) {
+        twin_pixmap_destroy(src);
+        return NULL;
+    }
+
+    if (src->format != TWIN_RGB16) {
+        if (!image_resample(dst, src, src->format == TWIN_ARGB32 ? 4 : 1)) {
+            twin_pixmap_destroy(dst);
+            dst = NULL;
+        }
+    } else {
+        /* Packed channels go through the transformed composite instead */
+        twin_matrix_scale(&src->transform,
+                          twin_fixed_div(twin_int_to_fixed(src->width),
+                                         twin_int_to_fixed(width)),
+                          twin_fixed_div(twin_int_to_fixed(src->height),
+                                         twin_int_to_fixed(height)));
+        twin_operand_t srcop = {
+            .source_kind = TWIN_PIXMAP,
+            .u.pixmap = src,
+        };
+        twin_composite(dst, 0, 0, &srcop, 0, 0, NULL, 0, 0, TWIN_SOURCE,
+                       width, height);
+    }
+    twin_pixmap_destroy(src);
+    return dst;
+}
+
+/*
+ * Decoded images are shared through a process-wide cache. Entries are
+ * keyed by what the pixels depend on: the path, the file's identity and
+ * modification time, the format and the requested size. They are kept in
+ * most recently used order, and unreferenced ones are dropped from the
+ * tail once the pixels held exceed the budget. Loads may come from worker
+ * threads, so the cache is locked; decoding happens outside the lock.
+ */
+typedef struct _image_cache_entry {
+    struct _image_cache_entry *prev, *next;
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    twin_format_t fmt;
+    twin_coord_t width, height;
+    twin_pixmap_t *pixmap;
+    size_t bytes;
+    int refs;
+    /* Handed out by twin_image_cache_acquire() without being shared */
+    bool uncached;
+} image_cache_entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    image_cache_entry_t *head, *tail;
+    size_t used, budget;
+} image_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .budget = (size_t) CONFIG_IMAGE_CACHE_SIZE * 1024,
+};
+
+static void image_cache_unlink(image_cache_entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        image_cache.head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        image_cache.tail = entry->prev;
+}
+
+static void image_cache_push(image_cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = image_cache.head;
+    if (image_cache.head)
+        image_cache.head->prev = entry;
+    else
+        image_cache.tail = entry;
+    image_cache.head = entry;
+}
+
+static void image_cache_free(image_cache_entry_t *entry)
+{
+    image_cache_unlink(entry);
+    image_cache.used -= entry->bytes;
+    if (entry->pixmap->animation)
+        twin_animation_destroy(entry->pixmap->animation);
+    twin_pixmap_destroy(entry->pixmap);
+    free(entry->path);
+    free(entry);
+}
+
+/* Drop unreferenced entries, least recently used first, to fit the budget */
+static void image_cache_trim(void)
+{
+    image_cache_entry_t *entry = image_cache.tail;
+
+    while (entry && image_cache.used > image_cache.budget) {
+        image_cache_entry_t *prev = entry->prev;
+        if (!entry->refs)
+            image_cache_free(entry);
+        entry = prev;
+    }
+}
+
+static bool image_cache_match(const image_cache_entry_t *entry,
+                              const image_cache_entry_t *key)
+{
+    return !entry->uncached && entry->dev == key->dev &&
+           entry->ino == key->ino &&
+           entry->size == key->size &&
+           entry->mtime.tv_sec == key->mtime.tv_sec &&
+           entry->mtime.tv_nsec == key->mtime.tv_nsec &&
+           entry->fmt == key->fmt && entry->width == key->width &&
+           entry->height == key->height && !strcmp(entry->path, key->path);
+}
+
+/* Find and reference an entry; the caller holds the lock */
+static image_cache_entry_t *image_cache_find(const image_cache_entry_t *key)
+{
+    for (image_cache_entry_t *entry = image_cache.head; entry;
+         entry = entry->next) {
+        if (image_cache_match(entry, key)) {
+            entry->refs++;
+            image_cache_unlink(entry);
+            image_cache_push(entry);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Return a referenced entry for the image, decoding it on a miss. Images
+ * that cannot be shared, animations or ones larger than the whole budget,
+ * are handed back through 'own' instead.
+ */
+static image_cache_entry_t *image_cache_get(const char *path,
+                                            twin_format_t fmt,
+                                            twin_coord_t width,
+                                            twin_coord_t height,
+                                            twin_pixmap_t **own)
 {
-    loader_func_t loader = image_loaders[image_type_detect(path)];
-    if (!loader)
+    image_cache_entry_t key = {
+        .path = (char *) path,
+        .fmt = fmt,
+        .width = width > 0 && height > 0 ? width : 0,
+        .height = width > 0 && height > 0 ? height : 0,
+    };
+    struct stat st;
+
+    *own = NULL;
+    if (stat(path, &st) < 0) {
+        log_error("Failed to open %s", path);
+        return NULL;
+    }
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+#if defined(__APPLE__)
+    key.mtime = st.st_mtimespec;
+#else
+    key.mtime = st.st_mtim;
+#endif
+
+    pthread_mutex_lock(&image_cache.lock);
+    image_cache_entry_t *entry = image_cache_find(&key);
+    pthread_mutex_unlock(&image_cache.lock);
+    if (entry)
+        return entry;
+
+    twin_pixmap_t *pix = image_decode(path, fmt, key.width, key.height);
+    if (!pix)
         return NULL;
-    return loader(path, fmt);
+    size_t bytes = (size_t) pix->stride * pix->height;
+
+    pthread_mutex_lock(&image_cache.lock);
+    if (pix->animation || bytes > image_cache.budget)
+        goto bail_own;
+
+    /* Another thread may have loaded the same image meanwhile */
+    entry = image_cache_find(&key);
+    if (entry) {
+        pthread_mutex_unlock(&image_cache.lock);
+        twin_pixmap_destroy(pix);
+        return entry;
+    }
+
+    entry = malloc(sizeof(image_cache_entry_t));
+    if (!entry)
+        goto bail_own;
+    *entry = key;
+    entry->uncached = false;
+    entry->path = strdup(path);
+    if (!entry->path) {
+        free(entry);
+        goto bail_own;
+    }
+    entry->pixmap = pix;
+    entry->bytes = bytes;
+    entry->refs = 1;
+    image_cache_push(entry);
+    image_cache.used += bytes;
+    image_cache_trim();
+    pthread_mutex_unlock(&image_cache.lock);
+    return entry;
+
+bail_own:
+    pthread_mutex_unlock(&image_cache.lock);
+    *own = pix;
+    return NULL;
+}
+
+static void image_cache_unref(image_cache_entry_t *entry)
+{
+    pthread_mutex_lock(&image_cache.lock);
+    entry->refs--;
+    image_cache_trim();
+    pthread_mutex_unlock(&image_cache.lock);
+}
+
+twin_pixmap_t *twin_image_cache_acquire(const char *path,
+                                        twin_format_t fmt,
+                                        twin_coord_t width,
+                                        twin_coord_t height)
+{
+    twin_pixmap_t *own;
+    image_cache_entry_t *entry =
+        image_cache_get(path, fmt, width, height, &own);
+
+    if (entry || !own)
+        return entry ? entry->pixmap : NULL;
+
+    /* An image that cannot be shared still goes to the caller; it is kept
+     * track of, outside the budget, so that releasing it destroys it
+     */
+    entry = calloc(1, sizeof(image_cache_entry_t));
+    if (!entry) {
+        if (own->animation)
+            twin_animation_destroy(own->animation);
+        twin_pixmap_destroy(own);
+        return NULL;
+    }
+    entry->pixmap = own;
+    entry->refs = 1;
+    entry->uncached = true;
+    pthread_mutex_lock(&image_cache.lock);
+    image_cache_push(entry);
+    pthread_mutex_unlock(&image_cache.lock);
+    return own;
+}
+
+void twin_image_cache_release(twin_pixmap_t *pixmap)
+{
+    image_cache_entry_t *entry;
+
+    pthread_mutex_lock(&image_cache.lock);
+    for (entry = image_cache.head; entry; entry = entry->next)
+        if (entry->pixmap == pixmap)
+            break;
+    if (entry && !--entry->refs && entry->uncached)
+        image_cache_free(entry);
+    else if (entry)
+        image_cache_trim();
+    pthread_mutex_unlock(&image_cache.lock);
+
+    if (!entry)
+        log_error("Releasing a pixmap not from the image cache");
+}
+
+void twin_image_cache_set_budget(size_t bytes)
+{
+    pthread_mutex_lock(&image_cache.lock);
+    image_cache.budget = bytes;
+    image_cache_trim();
+    pthread_mutex_unlock(&image_cache.lock);
+}
+
+twin_pixmap_t *twin_pixmap_from_file_scale(const char *path,
+                                           twin_format_t fmt,
+                                           twin_coord_t width,
+                                           twin_coord_t height)
+{
+    twin_pixmap_t *own;
+    image_cache_entry_t *entry =
+        image_cache_get(path, fmt, width, height, &own);
+
+    if (!entry)
+        return own;
+
+    /* Callers own what they load, so they get their own copy of the pixels */
+    twin_pixmap_t *src = entry->pixmap;
+    twin_pixmap_t *pix = twin_pixmap_create(src->format, src->width,
+                                            src->height);
+    if (pix)
+        memcpy(pix->p.b, src->p.b, (size_t) src->stride * src->height);
+    image_cache_unref(entry);
+    return pix;
+}
+
+twin_pixmap_t *twin_pixmap_from_file(const char *path, twin_format_t fmt)
+{
+    return twin_pixmap_from_file_scale(path, fmt, 0, 0);
 }
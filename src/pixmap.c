@@ -53,6 +53,7 @@ twin_pixmap_t *twin_pixmap_create(twin_format_t format,
 #endif
     pixmap->p.v = pixmap + 1;
     memset(pixmap->p.v, '\0', space);
+    pthread_mutex_init(&pixmap->lock, NULL);
     return pixmap;
 }
 
@@ -81,13 +82,20 @@ twin_pixmap_t *twin_pixmap_create_const(twin_format_t format,
     pixmap->stride = stride;
     pixmap->disable = 0;
     pixmap->p = pixels;
+    pthread_mutex_init(&pixmap->lock, NULL);
     return pixmap;
 }
 
 void twin_pixmap_destroy(twin_pixmap_t *pixmap)
 {
-    if (pixmap->screen)
+    if (pixmap->screen) {
+        /* Contacts still down on this pixmap are dropped */
+        for (int i = 0; i < TWIN_TOUCH_MAX; i++)
+            if (pixmap->screen->touch_target[i] == pixmap)
+                pixmap->screen->touch_target[i] = NULL;
         twin_pixmap_hide(pixmap);
+    }
+    pthread_mutex_destroy(&pixmap->lock);
     free(pixmap);
 }
 
@@ -95,6 +103,8 @@ void twin_pixmap_show(twin_pixmap_t *pixmap,
                       twin_screen_t *screen,
                       twin_pixmap_t *lower)
 {
+    twin_screen_lock(screen);
+
     if (pixmap->disable)
         twin_screen_disable_update(screen);
 
@@ -121,6 +131,7 @@ void twin_pixmap_show(twin_pixmap_t *pixmap,
     }
 
     twin_pixmap_damage(pixmap, 0, 0, pixmap->width, pixmap->height);
+    twin_screen_unlock(screen);
 }
 
 void twin_pixmap_hide(twin_pixmap_t *pixmap)
@@ -131,6 +142,7 @@ void twin_pixmap_hide(twin_pixmap_t *pixmap)
     if (!screen)
         return;
 
+    twin_screen_lock(screen);
     twin_pixmap_damage(pixmap, 0, 0, pixmap->width, pixmap->height);
 
     if (pixmap->up)
@@ -151,6 +163,7 @@ void twin_pixmap_hide(twin_pixmap_t *pixmap)
     pixmap->down = 0;
     if (pixmap->disable)
         twin_screen_enable_update(screen);
+    twin_screen_unlock(screen);
 }
 
 twin_pointer_t twin_pixmap_pointer(twin_pixmap_t *pixmap,
@@ -281,6 +294,16 @@ void twin_pixmap_reset_clip(twin_pixmap_t *pixmap)
     pixmap->clip.bottom = pixmap->height;
 }
 
+void twin_pixmap_lock(twin_pixmap_t *pixmap)
+{
+    pthread_mutex_lock(&pixmap->lock);
+}
+
+void twin_pixmap_unlock(twin_pixmap_t *pixmap)
+{
+    pthread_mutex_unlock(&pixmap->lock);
+}
+
 void twin_pixmap_damage(twin_pixmap_t *pixmap,
                         twin_coord_t left,
                         twin_coord_t top,
@@ -0,0 +1,365 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "twin_private.h"
+
+/*
+ * Input events reaching twin_screen_dispatch() can be saved with the time
+ * they arrived and fed back to a screen later, which turns an interaction
+ * captured on a device into a repeatable benchmark. Traces are text, one
+ * event per line: the arrival time in microseconds, the event name and its
+ * fields. Lines starting with '#' are comments.
+ */
+
+#define MADO_RECORD "MADO_RECORD"
+#define MADO_REPLAY "MADO_REPLAY"
+#define MADO_REPLAY_SPEED "MADO_REPLAY_SPEED"
+#define MADO_REPLAY_TIMING "MADO_REPLAY_TIMING"
+
+typedef enum {
+    TWIN_RECORD_POINTER,
+    TWIN_RECORD_KEY,
+    TWIN_RECORD_UCS4,
+    TWIN_RECORD_TOUCH,
+    TWIN_RECORD_JS,
+} twin_record_fields_t;
+
+static const struct {
+    twin_event_kind_t kind;
+    const char *name;
+    twin_record_fields_t fields;
+} record_kinds[] = {
+    {TwinEventButtonDown, "button-down", TWIN_RECORD_POINTER},
+    {TwinEventButtonUp, "button-up", TWIN_RECORD_POINTER},
+    {TwinEventMotion, "motion", TWIN_RECORD_POINTER},
+    {TwinEventKeyDown, "key-down", TWIN_RECORD_KEY},
+    {TwinEventKeyUp, "key-up", TWIN_RECORD_KEY},
+    {TwinEventUcs4, "ucs4", TWIN_RECORD_UCS4},
+    {TwinEventJoyButton, "joy-button", TWIN_RECORD_JS},
+    {TwinEventJoyAxis, "joy-axis", TWIN_RECORD_JS},
+    {TwinEventTouchDown, "touch-down", TWIN_RECORD_TOUCH},
+    {TwinEventTouchUp, "touch-up", TWIN_RECORD_TOUCH},
+    {TwinEventTouchMotion, "touch-motion", TWIN_RECORD_TOUCH},
+};
+
+#define TWIN_RECORD_KINDS (sizeof(record_kinds) / sizeof(record_kinds[0]))
+
+struct _twin_record {
+    FILE *fp;
+    twin_nsec_t start;
+};
+
+typedef struct {
+    twin_nsec_t when;
+    twin_event_t event;
+} twin_replay_event_t;
+
+struct _twin_replay {
+    twin_replay_event_t *events;
+    int n_events, next;
+    /* Playback rate relative to the recording, zero to run unpaced */
+    double speed;
+    twin_nsec_t start;
+    twin_timeout_t *timeout;
+    twin_work_t *finish;
+    bool timing;
+
+    unsigned long frames;
+    twin_nsec_t total, min, max;
+};
+
+static int _twin_record_kind(twin_event_kind_t kind)
+{
+    for (size_t i = 0; i < TWIN_RECORD_KINDS; i++)
+        if (record_kinds[i].kind == kind)
+            return i;
+    return -1;
+}
+
+bool twin_screen_record(twin_screen_t *screen, const char *path)
+{
+    twin_screen_record_stop(screen);
+
+    twin_record_t *record = malloc(sizeof(twin_record_t));
+    if (!record)
+        return false;
+    record->fp = fopen(path, "w");
+    if (!record->fp) {
+        log_error("Failed to open %s for recording", path);
+        free(record);
+        return false;
+    }
+
+    /* Flush every event so a trace survives the program being killed */
+    setvbuf(record->fp, NULL, _IOLBF, 0);
+    fprintf(record->fp, "# twin event trace, screen %dx%d\n", screen->width,
+            screen->height);
+    record->start = _twin_now_nsec();
+    screen->record = record;
+    return true;
+}
+
+void twin_screen_record_stop(twin_screen_t *screen)
+{
+    twin_record_t *record = screen->record;
+
+    if (!record)
+        return;
+    fclose(record->fp);
+    free(record);
+    screen->record = NULL;
+}
+
+void _twin_record_event(twin_screen_t *screen, const twin_event_t *event)
+{
+    twin_record_t *record = screen->record;
+    int k = _twin_record_kind(event->kind);
+
+    /* Only input is recorded; everything else is derived from it */
+    if (k < 0)
+        return;
+
+    long long usec = (_twin_now_nsec() - record->start) / 1000;
+    fprintf(record->fp, "%lld %s", usec, record_kinds[k].name);
+    switch (record_kinds[k].fields) {
+    case TWIN_RECORD_POINTER:
+        fprintf(record->fp, " %d %d %d\n", event->u.pointer.screen_x,
+                event->u.pointer.screen_y, event->u.pointer.button);
+        break;
+    case TWIN_RECORD_KEY:
+        fprintf(record->fp, " %u\n", (unsigned) event->u.key.key);
+        break;
+    case TWIN_RECORD_UCS4:
+        fprintf(record->fp, " %u\n", (unsigned) event->u.ucs4.ucs4);
+        break;
+    case TWIN_RECORD_TOUCH:
+        fprintf(record->fp, " %d %d %d\n", event->u.touch.id,
+                event->u.touch.screen_x, event->u.touch.screen_y);
+        break;
+    case TWIN_RECORD_JS:
+        fprintf(record->fp, " %d %d\n", event->u.js.control,
+                event->u.js.value);
+        break;
+    }
+}
+
+static bool _twin_replay_parse(const char *line, twin_replay_event_t *ev)
+{
+    long long usec;
+    char name[32];
+    int n, a, b, c;
+    unsigned u;
+
+    if (sscanf(line, "%lld %31s%n", &usec, name, &n) != 2)
+        return false;
+
+    int k = -1;
+    for (size_t i = 0; i < TWIN_RECORD_KINDS; i++)
+        if (!strcmp(record_kinds[i].name, name))
+            k = i;
+    if (k < 0)
+        return false;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->when = usec * 1000;
+    ev->event.kind = record_kinds[k].kind;
+    line += n;
+
+    switch (record_kinds[k].fields) {
+    case TWIN_RECORD_POINTER:
+        if (sscanf(line, "%d %d %d", &a, &b, &c) != 3)
+            return false;
+        ev->event.u.pointer.screen_x = a;
+        ev->event.u.pointer.screen_y = b;
+        ev->event.u.pointer.button = c;
+        return true;
+    case TWIN_RECORD_KEY:
+    case TWIN_RECORD_UCS4:
+        if (sscanf(line, "%u", &u) != 1)
+            return false;
+        if (record_kinds[k].fields == TWIN_RECORD_KEY)
+            ev->event.u.key.key = u;
+        else
+            ev->event.u.ucs4.ucs4 = u;
+        return true;
+    case TWIN_RECORD_TOUCH:
+        if (sscanf(line, "%d %d %d", &a, &b, &c) != 3 || a < 0 ||
+            a >= TWIN_TOUCH_MAX)
+            return false;
+        ev->event.u.touch.id = a;
+        ev->event.u.touch.screen_x = b;
+        ev->event.u.touch.screen_y = c;
+        return true;
+    case TWIN_RECORD_JS:
+        if (sscanf(line, "%d %d", &a, &b) != 2)
+            return false;
+        ev->event.u.js.control = a;
+        ev->event.u.js.value = b;
+        return true;
+    }
+    return false;
+}
+
+static bool _twin_replay_load(twin_replay_t *replay, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        log_error("Failed to open %s for replay", path);
+        return false;
+    }
+
+    char line[256];
+    int size = 0, lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (replay->n_events == size) {
+            int nsize = size ? size * 2 : 256;
+            twin_replay_event_t *n =
+                realloc(replay->events, nsize * sizeof(*n));
+            if (!n)
+                break;
+            replay->events = n;
+            size = nsize;
+        }
+        if (_twin_replay_parse(line, &replay->events[replay->n_events]))
+            replay->n_events++;
+        else
+            log_error("%s:%d: unrecognized event", path, lineno);
+    }
+    fclose(fp);
+
+    /* Playback starts with the first event, however late it was recorded */
+    for (int i = replay->n_events - 1; i >= 0; i--)
+        replay->events[i].when -= replay->events[0].when;
+    return replay->n_events > 0;
+}
+
+void twin_screen_replay_stop(twin_screen_t *screen)
+{
+    twin_replay_t *replay = screen->replay;
+
+    if (!replay)
+        return;
+    if (replay->finish)
+        twin_clear_work(replay->finish);
+    if (replay->timeout)
+        twin_clear_timeout(replay->timeout);
+    free(replay->events);
+    free(replay);
+    screen->replay = NULL;
+}
+
+/* Runs after the last replayed event has been composited */
+static bool _twin_replay_finish(void *closure)
+{
+    twin_screen_t *screen = closure;
+    twin_replay_t *replay = screen->replay;
+    twin_nsec_t wall = _twin_now_nsec() - replay->start;
+
+    log_info("Replayed %d events in %.3f s, %lu frames, update min %.3f ms, "
+             "avg %.3f ms, max %.3f ms",
+             replay->n_events, wall / 1e9, replay->frames, replay->min / 1e6,
+             replay->frames ? replay->total / 1e6 / replay->frames : 0.0,
+             replay->max / 1e6);
+    /* Returning false frees the work item */
+    replay->finish = NULL;
+    twin_screen_replay_stop(screen);
+    _twin_dispatch_stop();
+    return false;
+}
+
+static twin_time_t _twin_replay_timeout(twin_time_t now maybe_unused,
+                                        void *closure)
+{
+    twin_screen_t *screen = closure;
+    twin_replay_t *replay = screen->replay;
+    twin_nsec_t t = _twin_now_nsec() - replay->start;
+
+    /* Unpaced, each event gets a main loop pass and so a frame of its own */
+    do {
+        twin_event_t event = replay->events[replay->next++].event;
+        twin_screen_dispatch(screen, &event);
+        /* The event may have ended the replay */
+        if (screen->replay != replay)
+            return -1;
+    } while (replay->speed > 0 && replay->next < replay->n_events &&
+             replay->events[replay->next].when <= t * replay->speed);
+
+    if (replay->next == replay->n_events) {
+        replay->timeout = NULL;
+        replay->finish = twin_set_work(_twin_replay_finish,
+                                       TWIN_WORK_REDISPLAY - 1, screen);
+        return -1;
+    }
+    if (replay->speed <= 0)
+        return 0;
+
+    twin_nsec_t due = replay->events[replay->next].when / replay->speed;
+    return (twin_time_t) ((due - t + 999999) / 1000000);
+}
+
+bool twin_screen_replay(twin_screen_t *screen, const char *path, double speed)
+{
+    if (screen->replay)
+        twin_screen_replay_stop(screen);
+
+    twin_replay_t *replay = calloc(1, sizeof(twin_replay_t));
+    if (!replay)
+        return false;
+    if (!_twin_replay_load(replay, path)) {
+        free(replay->events);
+        free(replay);
+        return false;
+    }
+
+    replay->speed = speed;
+    replay->timing = getenv(MADO_REPLAY_TIMING) != NULL;
+    replay->start = _twin_now_nsec();
+    replay->timeout = twin_set_timeout(_twin_replay_timeout, 0, screen);
+    if (!replay->timeout) {
+        free(replay->events);
+        free(replay);
+        return false;
+    }
+    screen->replay = replay;
+    return true;
+}
+
+void _twin_replay_frame(twin_screen_t *screen, twin_nsec_t elapsed)
+{
+    twin_replay_t *replay = screen->replay;
+
+    replay->frames++;
+    replay->total += elapsed;
+    if (replay->frames == 1 || elapsed < replay->min)
+        replay->min = elapsed;
+    if (elapsed > replay->max)
+        replay->max = elapsed;
+    if (replay->timing)
+        printf("frame %lu: event %d, %lld ns\n", replay->frames,
+               replay->next, (long long) elapsed);
+}
+
+void _twin_record_init(twin_screen_t *screen)
+{
+    const char *path = getenv(MADO_RECORD);
+    if (path && twin_screen_record(screen, path))
+        log_info("Recording events to %s", path);
+
+    path = getenv(MADO_REPLAY);
+    if (path) {
+        const char *env = getenv(MADO_REPLAY_SPEED);
+        double speed = env ? atof(env) : 1.0;
+        if (twin_screen_replay(screen, path, speed))
+            log_info("Replaying events from %s at speed %g", path, speed);
+    }
+}
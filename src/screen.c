@@ -31,9 +31,17 @@ twin_screen_t *twin_screen_create(twin_coord_t width,
     screen->background = 0;
     screen->put_begin = put_begin;
     screen->put_span = put_span;
+    screen->get_span = NULL;
     screen->closure = closure;
 
     screen->button_x = screen->button_y = -1;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&screen->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&screen->damage_lock, NULL);
     return screen;
 }
 
@@ -41,9 +49,23 @@ void twin_screen_destroy(twin_screen_t *screen)
 {
     while (screen->bottom)
         twin_pixmap_hide(screen->bottom);
+    twin_screen_record_stop(screen);
+    twin_screen_replay_stop(screen);
+    pthread_mutex_destroy(&screen->damage_lock);
+    pthread_mutex_destroy(&screen->lock);
     free(screen);
 }
 
+void twin_screen_lock(twin_screen_t *screen)
+{
+    pthread_mutex_lock(&screen->lock);
+}
+
+void twin_screen_unlock(twin_screen_t *screen)
+{
+    pthread_mutex_unlock(&screen->lock);
+}
+
 void twin_screen_register_damaged(twin_screen_t *screen,
                                   void (*damaged)(void *),
                                   void *closure)
@@ -52,20 +74,31 @@ void twin_screen_register_damaged(twin_screen_t *screen,
     screen->damaged_closure = closure;
 }
 
+void twin_screen_register_get_span(twin_screen_t *screen,
+                                   twin_get_span_t get_span)
+{
+    screen->get_span = get_span;
+}
+
 void twin_screen_enable_update(twin_screen_t *screen)
 {
-    if (--screen->disable == 0) {
-        if (screen->damage.left < screen->damage.right &&
-            screen->damage.top < screen->damage.bottom) {
-            if (screen->damaged)
-                (*screen->damaged)(screen->damaged_closure);
-        }
-    }
+    bool notify;
+
+    pthread_mutex_lock(&screen->damage_lock);
+    notify = --screen->disable == 0 &&
+             screen->damage.left < screen->damage.right &&
+             screen->damage.top < screen->damage.bottom;
+    pthread_mutex_unlock(&screen->damage_lock);
+
+    if (notify && screen->damaged)
+        (*screen->damaged)(screen->damaged_closure);
 }
 
 void twin_screen_disable_update(twin_screen_t *screen)
 {
+    pthread_mutex_lock(&screen->damage_lock);
     screen->disable++;
+    pthread_mutex_unlock(&screen->damage_lock);
 }
 
 void twin_screen_damage(twin_screen_t *screen,
@@ -83,6 +116,7 @@ void twin_screen_damage(twin_screen_t *screen,
     if (bottom > screen->height)
         bottom = screen->height;
 
+    pthread_mutex_lock(&screen->damage_lock);
     if (screen->damage.left == screen->damage.right) {
         screen->damage.left = left;
         screen->damage.right = right;
@@ -98,8 +132,14 @@ void twin_screen_damage(twin_screen_t *screen,
         if (screen->damage.bottom < bottom)
             screen->damage.bottom = bottom;
     }
-    if (screen->damaged && !screen->disable)
+    bool notify = !screen->disable;
+    pthread_mutex_unlock(&screen->damage_lock);
+
+    if (screen->damaged && notify)
         (*screen->damaged)(screen->damaged_closure);
+
+    /* Input threads may damage the screen while the main loop sleeps */
+    _twin_wakeup();
 }
 
 void twin_screen_resize(twin_screen_t *screen,
@@ -113,8 +153,11 @@ void twin_screen_resize(twin_screen_t *screen,
 
 bool twin_screen_damaged(twin_screen_t *screen)
 {
-    return (screen->damage.left < screen->damage.right &&
-            screen->damage.top < screen->damage.bottom);
+    pthread_mutex_lock(&screen->damage_lock);
+    bool damaged = (screen->damage.left < screen->damage.right &&
+                    screen->damage.top < screen->damage.bottom);
+    pthread_mutex_unlock(&screen->damage_lock);
+    return damaged;
 }
 
 static void twin_screen_span_pixmap(twin_screen_t maybe_unused *screen,
@@ -153,13 +196,37 @@ static void twin_screen_span_pixmap(twin_screen_t maybe_unused *screen,
         op32(dst, src, p_right - p_left);
 }
 
+static bool _twin_screen_pixmap_visible(twin_pixmap_t *p,
+                                        twin_coord_t left,
+                                        twin_coord_t top,
+                                        twin_coord_t right,
+                                        twin_coord_t bottom)
+{
+    return p->x < right && left < p->x + p->width && p->y < bottom &&
+           top < p->y + p->height;
+}
+
 void twin_screen_update(twin_screen_t *screen)
 {
-    twin_coord_t left = screen->damage.left;
-    twin_coord_t top = screen->damage.top;
-    twin_coord_t right = screen->damage.right;
-    twin_coord_t bottom = screen->damage.bottom;
+    twin_coord_t left, top, right, bottom;
     twin_src_op pop16, pop32, bop32;
+    bool disable;
+    twin_nsec_t start = screen->replay ? _twin_now_nsec() : 0;
+
+    twin_screen_lock(screen);
+
+    /* Take the damage over; new damage keeps accumulating meanwhile */
+    pthread_mutex_lock(&screen->damage_lock);
+    left = screen->damage.left;
+    top = screen->damage.top;
+    right = screen->damage.right;
+    bottom = screen->damage.bottom;
+    disable = screen->disable;
+    if (!disable) {
+        screen->damage.left = screen->damage.right = 0;
+        screen->damage.top = screen->damage.bottom = 0;
+    }
+    pthread_mutex_unlock(&screen->damage_lock);
 
     pop16 = _twin_rgb16_source_argb32;
     pop32 = _twin_argb32_over_argb32;
@@ -170,22 +237,34 @@ void twin_screen_update(twin_screen_t *screen)
     if (bottom > screen->height)
         bottom = screen->height;
 
-    if (!screen->disable && left < right && top < bottom) {
+    if (!disable && left < right && top < bottom) {
         twin_argb32_t *span;
         twin_pixmap_t *p;
         twin_coord_t y;
         twin_coord_t width = right - left;
 
-        screen->damage.left = screen->damage.right = 0;
-        screen->damage.top = screen->damage.bottom = 0;
         /* FIXME: what is the maximum number of lines? */
         span = malloc(width * sizeof(twin_argb32_t));
-        if (!span)
+        if (!span) {
+            twin_screen_unlock(screen);
             return;
+        }
+
+        /* Keep drawing threads out of the pixmaps being composited */
+        for (p = screen->bottom; p; p = p->up)
+            if (_twin_screen_pixmap_visible(p, left, top, right, bottom))
+                twin_pixmap_lock(p);
 
         if (screen->put_begin)
             (*screen->put_begin)(left, top, right, bottom, screen->closure);
         for (y = top; y < bottom; y++) {
+            /* Compose straight into the output when it is ARGB32 */
+            twin_argb32_t *line = NULL;
+            if (screen->get_span)
+                line = (*screen->get_span)(left, y, right, screen->closure);
+            if (!line)
+                line = span;
+
             if (screen->background) {
                 twin_pointer_t dst;
                 twin_source_u src;
@@ -196,7 +275,7 @@ void twin_screen_update(twin_screen_t *screen)
                 twin_coord_t p_y = y % screen->background->height;
 
                 for (p_left = left; p_left < right; p_left += p_this) {
-                    dst.argb32 = span + (p_left - left);
+                    dst.argb32 = line + (p_left - left);
                     m_left = p_left % p_width;
                     p_this = p_width - m_left;
                     if (p_left + p_this > right)
@@ -206,28 +285,34 @@ void twin_screen_update(twin_screen_t *screen)
                     bop32(dst, src, p_this);
                 }
             } else
-                memset(span, 0xff, width * sizeof(twin_argb32_t));
+                memset(line, 0xff, width * sizeof(twin_argb32_t));
 
             for (p = screen->bottom; p; p = p->up) {
                 /* Skip drawing the region of the iconified pixmap. */
                 if (!twin_pixmap_is_iconified(p, y))
-                    twin_screen_span_pixmap(screen, span, p, y, left, right,
+                    twin_screen_span_pixmap(screen, line, p, y, left, right,
                                             pop16, pop32);
             }
 
 #if defined(CONFIG_CURSOR)
-            if (screen->cursor) {
-                /* Skip drawing the region of the iconified pixmap. */
-                if (!twin_pixmap_is_iconified(p, y))
-                    twin_screen_span_pixmap(screen, span, screen->cursor, y,
-                                            left, right, pop16, pop32);
-            }
+            if (screen->cursor)
+                twin_screen_span_pixmap(screen, line, screen->cursor, y, left,
+                                        right, pop16, pop32);
 #endif
 
-            (*screen->put_span)(left, y, right, span, screen->closure);
+            (*screen->put_span)(left, y, right, line, screen->closure);
         }
+
+        for (p = screen->bottom; p; p = p->up)
+            if (_twin_screen_pixmap_visible(p, left, top, right, bottom))
+                twin_pixmap_unlock(p);
         free(span);
+
+        if (screen->replay)
+            _twin_replay_frame(screen, _twin_now_nsec() - start);
     }
+
+    twin_screen_unlock(screen);
 }
 
 void twin_screen_set_active(twin_screen_t *screen, twin_pixmap_t *pixmap)
@@ -322,7 +407,7 @@ static void _twin_adj_mouse_evt(twin_event_t *event,
     event->u.pointer.y = event->u.pointer.screen_y - pixmap->y;
 }
 
-bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
+static bool _twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
 {
     twin_pixmap_t *pixmap, *ntarget;
 
@@ -394,6 +479,30 @@ bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
         pixmap = screen->active;
         break;
 
+    case TwinEventTouchDown:
+    case TwinEventTouchMotion:
+    case TwinEventTouchUp:
+        if (event->u.touch.id < 0 || event->u.touch.id >= TWIN_TOUCH_MAX)
+            return false;
+
+        /* each contact stays with the pixmap it went down on */
+        if (event->kind == TwinEventTouchDown) {
+            for (pixmap = screen->top; pixmap; pixmap = pixmap->down)
+                if (twin_window_valid_range(pixmap->window,
+                                            event->u.touch.screen_x,
+                                            event->u.touch.screen_y))
+                    break;
+            screen->touch_target[event->u.touch.id] = pixmap;
+        }
+        pixmap = screen->touch_target[event->u.touch.id];
+        if (event->kind == TwinEventTouchUp)
+            screen->touch_target[event->u.touch.id] = NULL;
+        if (pixmap) {
+            event->u.touch.x = event->u.touch.screen_x - pixmap->x;
+            event->u.touch.y = event->u.touch.screen_y - pixmap->y;
+        }
+        break;
+
     default:
         pixmap = NULL;
         break;
@@ -402,3 +511,17 @@ bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
         return twin_pixmap_dispatch(pixmap, event);
     return false;
 }
+
+bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
+{
+    bool result;
+
+    if (screen->record)
+        _twin_record_event(screen, event);
+
+    /* Pick the target while no other thread restacks the pixmaps */
+    twin_screen_lock(screen);
+    result = _twin_screen_dispatch(screen, event);
+    twin_screen_unlock(screen);
+    return result;
+}
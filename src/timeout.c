@@ -1,63 +1,160 @@
 /*
  * Twin - A Tiny Window System
  * Copyright (c) 2004 Keith Packard <keithp@keithp.com>
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
  * All rights reserved.
  */
 
 #include <stdlib.h>
-#include <sys/time.h>
 #include <time.h>
 
 #include "twin_private.h"
 
-#define twin_time_compare(a, op, b) (((a) - (b)) op 0)
+/*
+ * Timeouts live in a binary min-heap ordered by their absolute deadline on
+ * CLOCK_MONOTONIC, so wall-clock adjustments never stall or burst-fire them.
+ * Every timeout remembers its heap slot, which makes cancellation O(log n).
+ */
+
+#define TWIN_NSEC_PER_MSEC 1000000LL
+#define TWIN_NSEC_PER_SEC 1000000000LL
+
+/* Heap slots below zero describe timeouts that are not in the heap */
+#define TWIN_TIMEOUT_RUNNING (-1)
+#define TWIN_TIMEOUT_CANCELLED (-2)
+
+static twin_timeout_t **heap;
+static int heap_len, heap_size;
+
+/* Timeouts expired in the current tick, run after the heap is settled */
+static twin_timeout_t **batch;
+static int batch_size;
+
+twin_nsec_t _twin_now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (twin_nsec_t) ts.tv_sec * TWIN_NSEC_PER_SEC + ts.tv_nsec;
+}
 
-static twin_time_t twin_now(void)
+twin_time_t twin_now(void)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    return (twin_time_t) (_twin_now_nsec() / TWIN_NSEC_PER_MSEC);
 }
 
-static twin_queue_t *head;
-static twin_time_t start;
+static void _twin_heap_set(int index, twin_timeout_t *timeout)
+{
+    heap[index] = timeout;
+    timeout->index = index;
+}
 
-static twin_order_t _twin_timeout_order(twin_queue_t *a, twin_queue_t *b)
+static void _twin_heap_up(int index)
 {
-    const twin_timeout_t *at = (twin_timeout_t *) a;
-    const twin_timeout_t *bt = (twin_timeout_t *) b;
-
-    if (twin_time_compare(at->time, <, bt->time))
-        return TWIN_AFTER;
-    if (twin_time_compare(at->time, >, bt->time))
-        return TWIN_BEFORE;
-    return TWIN_AT;
+    twin_timeout_t *timeout = heap[index];
+
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (heap[parent]->deadline <= timeout->deadline)
+            break;
+        _twin_heap_set(index, heap[parent]);
+        index = parent;
+    }
+    _twin_heap_set(index, timeout);
 }
 
-static void _twin_queue_timeout(twin_timeout_t *timeout, twin_time_t time)
+static void _twin_heap_down(int index)
 {
-    timeout->time = time;
-    _twin_queue_remove(&head, &timeout->queue);
-    _twin_queue_insert(&head, _twin_timeout_order, &timeout->queue);
+    twin_timeout_t *timeout = heap[index];
+
+    for (;;) {
+        int child = index * 2 + 1;
+        if (child >= heap_len)
+            break;
+        if (child + 1 < heap_len &&
+            heap[child + 1]->deadline < heap[child]->deadline)
+            child++;
+        if (timeout->deadline <= heap[child]->deadline)
+            break;
+        _twin_heap_set(index, heap[child]);
+        index = child;
+    }
+    _twin_heap_set(index, timeout);
+}
+
+static bool _twin_heap_push(twin_timeout_t *timeout)
+{
+    if (heap_len == heap_size) {
+        int size = heap_size ? heap_size * 2 : 16;
+        twin_timeout_t **h = realloc(heap, size * sizeof(*heap));
+        if (!h)
+            return false;
+        heap = h;
+        heap_size = size;
+    }
+    heap[heap_len] = timeout;
+    _twin_heap_up(heap_len++);
+    return true;
+}
+
+static void _twin_heap_remove(twin_timeout_t *timeout)
+{
+    int index = timeout->index;
+    twin_timeout_t *last = heap[--heap_len];
+
+    if (last != timeout) {
+        _twin_heap_set(index, last);
+        if (index > 0 && heap[(index - 1) / 2]->deadline > last->deadline)
+            _twin_heap_up(index);
+        else
+            _twin_heap_down(index);
+    }
 }
 
 void _twin_run_timeout(void)
 {
-    twin_time_t now = twin_now();
-    twin_timeout_t *timeout;
-    twin_time_t delay;
-
-    twin_timeout_t *first = (twin_timeout_t *) _twin_queue_set_order(&head);
-    for (timeout = first; timeout && twin_time_compare(now, >=, timeout->time);
-         timeout = (twin_timeout_t *) timeout->queue.order) {
-        delay = (*timeout->proc)(now, timeout->closure);
-        if (delay >= 0) {
-            timeout->time = twin_now() + delay;
-            _twin_queue_reorder(&head, _twin_timeout_order, &timeout->queue);
-        } else
-            _twin_queue_delete(&head, &timeout->queue);
+    twin_nsec_t tick = _twin_now_nsec();
+    int n = 0;
+
+    if (!heap_len || heap[0]->deadline > tick)
+        return;
+
+    /* Pull every timeout due in this tick before running any of them */
+    while (heap_len && heap[0]->deadline <= tick) {
+        if (n == batch_size) {
+            int size = batch_size ? batch_size * 2 : 16;
+            twin_timeout_t **b = realloc(batch, size * sizeof(*batch));
+            if (!b)
+                break;
+            batch = b;
+            batch_size = size;
+        }
+        twin_timeout_t *timeout = heap[0];
+        _twin_heap_remove(timeout);
+        timeout->index = TWIN_TIMEOUT_RUNNING;
+        batch[n++] = timeout;
+    }
+
+    /* Each entry is settled before the next proc runs: procs may clear
+     * timeouts later in the batch, and those are only marked cancelled,
+     * but a timeout re-armed here is back on the heap and freed at once.
+     */
+    twin_time_t now = (twin_time_t) (tick / TWIN_NSEC_PER_MSEC);
+    for (int i = 0; i < n; i++) {
+        twin_timeout_t *timeout = batch[i];
+        if (timeout->index == TWIN_TIMEOUT_CANCELLED) {
+            free(timeout);
+            continue;
+        }
+
+        twin_time_t delay = (*timeout->proc)(now, timeout->closure);
+        if (timeout->index != TWIN_TIMEOUT_CANCELLED && delay >= 0) {
+            timeout->delay = delay;
+            timeout->deadline = _twin_now_nsec() + delay * TWIN_NSEC_PER_MSEC;
+            if (_twin_heap_push(timeout))
+                continue;
+        }
+        free(timeout);
     }
-    _twin_queue_review_order(&first->queue);
 }
 
 twin_timeout_t *twin_set_timeout(twin_timeout_proc_t timeout_proc,
@@ -68,28 +165,42 @@ twin_timeout_t *twin_set_timeout(twin_timeout_proc_t timeout_proc,
     if (!timeout)
         return NULL;
 
-    if (!start)
-        start = twin_now();
     timeout->delay = delay;
     timeout->proc = timeout_proc;
     timeout->closure = closure;
-    _twin_queue_timeout(timeout, twin_now() + delay);
+    timeout->deadline = _twin_now_nsec() + delay * TWIN_NSEC_PER_MSEC;
+    if (!_twin_heap_push(timeout)) {
+        free(timeout);
+        return NULL;
+    }
     return timeout;
 }
 
 void twin_clear_timeout(twin_timeout_t *timeout)
 {
-    _twin_queue_delete(&head, &timeout->queue);
+    if (timeout->index < 0) {
+        /* Expired in the current tick, freed once the tick reaches it */
+        timeout->index = TWIN_TIMEOUT_CANCELLED;
+        return;
+    }
+    _twin_heap_remove(timeout);
+    free(timeout);
+}
+
+twin_nsec_t _twin_timeout_deadline(void)
+{
+    return heap_len ? heap[0]->deadline : -1;
 }
 
 twin_time_t _twin_timeout_delay(void)
 {
-    if (head) {
-        const twin_timeout_t *thead = (twin_timeout_t *) head;
-        twin_time_t now = twin_now();
-        if (twin_time_compare(now, >=, thead->time))
+    if (heap_len) {
+        twin_nsec_t delta = heap[0]->deadline - _twin_now_nsec();
+        if (delta <= 0)
             return 0;
-        return thead->time - now;
+        /* Round up so the caller never wakes before the deadline */
+        delta = (delta + TWIN_NSEC_PER_MSEC - 1) / TWIN_NSEC_PER_MSEC;
+        return delta > INT32_MAX ? INT32_MAX : (twin_time_t) delta;
     }
     return -1;
 }
@@ -112,7 +112,7 @@ void _twin_toplevel_queue_paint(twin_widget_t *widget)
 
     if (!toplevel->box.widget.paint) {
         toplevel->box.widget.paint = true;
-        twin_set_work(_twin_toplevel_paint, TWIN_WORK_PAINT, toplevel);
+        twin_set_work_once(_twin_toplevel_paint, TWIN_WORK_PAINT, toplevel);
     }
 }
 
@@ -139,7 +139,7 @@ void _twin_toplevel_queue_layout(twin_widget_t *widget)
 
     if (!toplevel->box.widget.layout) {
         toplevel->box.widget.layout = true;
-        twin_set_work(_twin_toplevel_layout, TWIN_WORK_LAYOUT, toplevel);
+        twin_set_work_once(_twin_toplevel_layout, TWIN_WORK_LAYOUT, toplevel);
         _twin_toplevel_queue_paint(widget);
     }
 }
@@ -486,7 +486,7 @@ void twin_window_queue_paint(twin_window_t *window)
 {
     if (!window->draw_queued) {
         window->draw_queued = true;
-        twin_set_work(_twin_window_repaint, TWIN_WORK_PAINT, window);
+        twin_set_work_once(_twin_window_repaint, TWIN_WORK_PAINT, window);
     }
 }
 
@@ -591,6 +591,12 @@ bool twin_window_dispatch(twin_window_t *window, twin_event_t *event)
         } else
             delegate = false;
         break;
+    case TwinEventTouchDown:
+    case TwinEventTouchMotion:
+    case TwinEventTouchUp:
+        ev.u.touch.x -= window->client.left;
+        ev.u.touch.y -= window->client.top;
+        break;
     default:
         break;
     }
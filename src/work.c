@@ -1,59 +1,219 @@
 /*
  * Twin - A Tiny Window System
  * Copyright (c) 2004 Keith Packard <keithp@keithp.com>
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
  * All rights reserved.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "twin_private.h"
 
-static twin_queue_t *head;
+/*
+ * Work items are kept in one FIFO bucket per priority, with the buckets
+ * sorted from the highest priority down. Queueing appends to the bucket
+ * tail in O(1). Finished items go back to a free list instead of the heap,
+ * and items queued through twin_set_work_once() are indexed by
+ * (proc, closure) so that a pending request is never duplicated.
+ */
+
+#define TWIN_WORK_HASH_SIZE 64
+
+typedef struct _twin_work_bucket {
+    struct _twin_work_bucket *next;
+    int priority;
+    twin_work_t *head, *tail;
+} twin_work_bucket_t;
+
+static twin_work_bucket_t *buckets;
+static twin_work_t *free_list;
+static twin_work_t *hash[TWIN_WORK_HASH_SIZE];
+
+/* Set when work is queued, cleared as a pass over the buckets starts */
+static bool queued;
+
+static unsigned _twin_work_hash(twin_work_proc_t proc, void *closure)
+{
+    uintptr_t h = (uintptr_t) proc ^ ((uintptr_t) closure * 31);
+
+    h ^= h >> 16;
+    h ^= h >> 8;
+    return h % TWIN_WORK_HASH_SIZE;
+}
+
+static twin_work_t *_twin_work_lookup(twin_work_proc_t proc, void *closure)
+{
+    twin_work_t *work;
+
+    for (work = hash[_twin_work_hash(proc, closure)]; work;
+         work = work->hash_next)
+        if (work->proc == proc && work->closure == closure)
+            return work;
+    return NULL;
+}
+
+static void _twin_work_unhash(twin_work_t *work)
+{
+    twin_work_t **prev = &hash[_twin_work_hash(work->proc, work->closure)];
+
+    for (; *prev; prev = &(*prev)->hash_next)
+        if (*prev == work) {
+            *prev = work->hash_next;
+            break;
+        }
+    work->once = false;
+}
+
+static twin_work_bucket_t *_twin_work_bucket(int priority)
+{
+    twin_work_bucket_t **prev, *b;
 
-static twin_order_t _twin_work_order(twin_queue_t *a, twin_queue_t *b)
+    for (prev = &buckets; (b = *prev); prev = &b->next) {
+        if (b->priority == priority)
+            return b;
+        if (b->priority < priority)
+            break;
+    }
+
+    b = malloc(sizeof(twin_work_bucket_t));
+    if (!b)
+        return NULL;
+    b->priority = priority;
+    b->head = b->tail = NULL;
+    b->next = *prev;
+    *prev = b;
+    return b;
+}
+
+static twin_work_t *_twin_work_alloc(void)
 {
-    const twin_work_t *aw = (twin_work_t *) a, *bw = (twin_work_t *) b;
+    twin_work_t *work = free_list;
 
-    if (aw->priority < bw->priority)
-        return TWIN_BEFORE;
-    if (aw->priority > bw->priority)
-        return TWIN_AFTER;
-    return TWIN_AT;
+    if (work) {
+        free_list = work->next;
+        return work;
+    }
+    return malloc(sizeof(twin_work_t));
+}
+
+static void _twin_work_free(twin_work_t *work)
+{
+    if (work->once)
+        _twin_work_unhash(work);
+    work->next = free_list;
+    free_list = work;
 }
 
-static void _twin_queue_work(twin_work_t *work)
+static void _twin_run_bucket(twin_work_bucket_t *b)
 {
-    _twin_queue_insert(&head, _twin_work_order, &work->queue);
+    /* Work queued while this bucket runs waits for the next pass */
+    twin_work_t *last = b->tail;
+    twin_work_t *prev = NULL, *work = b->head;
+
+    while (work) {
+        bool done = work == last;
+
+        if (!work->deleted && !(*work->proc)(work->closure))
+            twin_clear_work(work);
+
+        twin_work_t *next = work->next;
+        if (work->deleted) {
+            if (prev)
+                prev->next = next;
+            else
+                b->head = next;
+            if (b->tail == work)
+                b->tail = prev;
+            _twin_work_free(work);
+        } else {
+            prev = work;
+        }
+
+        if (done)
+            break;
+        work = next;
+    }
 }
 
 void _twin_run_work(void)
 {
-    twin_work_t *work;
-    twin_work_t *first;
+    queued = false;
+    for (twin_work_bucket_t *b = buckets; b; b = b->next)
+        if (b->head)
+            _twin_run_bucket(b);
+}
+
+bool _twin_work_pending(void)
+{
+    /* Work queued during a pass may have missed it: a bucket that already
+     * ran, or the tail of the running one. Rather than track which, the
+     * main loop takes another pass without sleeping.
+     */
+    return queued;
+}
+
+static twin_work_t *_twin_queue_work(twin_work_proc_t work_proc,
+                                     int priority,
+                                     void *closure)
+{
+    twin_work_bucket_t *b = _twin_work_bucket(priority);
+    if (!b)
+        return NULL;
+
+    twin_work_t *work = _twin_work_alloc();
+    if (!work)
+        return NULL;
 
-    first = (twin_work_t *) _twin_queue_set_order(&head);
-    for (work = first; work; work = (twin_work_t *) work->queue.order)
-        if (!(*work->proc)(work->closure))
-            _twin_queue_delete(&head, &work->queue);
-    _twin_queue_review_order(&first->queue);
+    work->next = NULL;
+    work->hash_next = NULL;
+    work->priority = priority;
+    work->deleted = false;
+    work->once = false;
+    work->proc = work_proc;
+    work->closure = closure;
+
+    if (b->tail)
+        b->tail->next = work;
+    else
+        b->head = work;
+    b->tail = work;
+
+    queued = true;
+    _twin_wakeup();
+    return work;
 }
 
 twin_work_t *twin_set_work(twin_work_proc_t work_proc,
                            int priority,
                            void *closure)
 {
-    twin_work_t *work = malloc(sizeof(twin_work_t));
+    return _twin_queue_work(work_proc, priority, closure);
+}
+
+twin_work_t *twin_set_work_once(twin_work_proc_t work_proc,
+                                int priority,
+                                void *closure)
+{
+    twin_work_t *work = _twin_work_lookup(work_proc, closure);
+    if (work)
+        return work;
+
+    work = _twin_queue_work(work_proc, priority, closure);
     if (!work)
         return NULL;
 
-    work->proc = work_proc;
-    work->priority = priority;
-    work->closure = closure;
-    _twin_queue_work(work);
+    unsigned h = _twin_work_hash(work_proc, closure);
+    work->once = true;
+    work->hash_next = hash[h];
+    hash[h] = work;
     return work;
 }
 
 void twin_clear_work(twin_work_t *work)
 {
-    _twin_queue_delete(&head, &work->queue);
+    /* Unlinked by the next run, but free to be scheduled again right away */
+    if (work->once)
+        _twin_work_unhash(work);
+    work->deleted = true;
 }
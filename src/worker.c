@@ -0,0 +1,211 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "twin_private.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * A fixed pool of worker threads takes jobs from a priority-ordered queue.
+ * Finished and cancelled jobs collect on a done list; the workers poke a
+ * descriptor watched by the main loop, which then queues a work item that
+ * runs the done procs on the dispatching thread.
+ */
+
+#define TWIN_WORKER_MAX 4
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static twin_queue_t *pending;
+static twin_job_t *done_head, *done_tail;
+
+static int n_workers = -1;
+static int notify_fd[2] = {-1, -1};
+
+static twin_order_t _twin_job_order(twin_queue_t *a, twin_queue_t *b)
+{
+    const twin_job_t *aj = (twin_job_t *) a, *bj = (twin_job_t *) b;
+
+    if (aj->priority < bj->priority)
+        return TWIN_BEFORE;
+    if (aj->priority > bj->priority)
+        return TWIN_AFTER;
+    return TWIN_AT;
+}
+
+static void _twin_job_notify(void)
+{
+#if defined(__linux__)
+    uint64_t one = 1;
+#else
+    uint8_t one = 1;
+#endif
+    if (write(notify_fd[1], &one, sizeof(one)) < 0)
+        log_error("Failed to notify the main loop of finished jobs");
+    /* Backends that do not sleep on the descriptor still need to wake up */
+    _twin_wakeup();
+}
+
+/* Called with the lock held */
+static void _twin_job_finish(twin_job_t *job)
+{
+    job->next = NULL;
+    if (done_tail)
+        done_tail->next = job;
+    else
+        done_head = job;
+    done_tail = job;
+}
+
+static void *_twin_worker_thread(void *arg maybe_unused)
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!pending)
+            pthread_cond_wait(&cond, &lock);
+
+        twin_job_t *job = (twin_job_t *) pending;
+        _twin_queue_remove(&pending, &job->queue);
+        job->started = true;
+
+        if (!job->cancelled) {
+            pthread_mutex_unlock(&lock);
+            (*job->proc)(job->closure);
+            pthread_mutex_lock(&lock);
+        }
+
+        _twin_job_finish(job);
+        _twin_job_notify();
+    }
+    return NULL;
+}
+
+static bool _twin_job_deliver(void *closure maybe_unused)
+{
+    pthread_mutex_lock(&lock);
+    twin_job_t *job = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&lock);
+
+    while (job) {
+        twin_job_t *next = job->next;
+        if (job->done)
+            (*job->done)(job->closure, job->cancelled);
+        free(job);
+        job = next;
+    }
+    return false;
+}
+
+static bool _twin_job_notified(int file,
+                               twin_file_op_t ops maybe_unused,
+                               void *closure maybe_unused)
+{
+    uint8_t buf[64];
+
+    while (read(file, buf, sizeof(buf)) > 0)
+        ;
+    twin_set_work_once(_twin_job_deliver, TWIN_WORK_LAYOUT, NULL);
+    return true;
+}
+
+static bool _twin_worker_init(void)
+{
+    if (n_workers >= 0)
+        return n_workers > 0;
+    n_workers = 0;
+
+#if defined(__linux__)
+    notify_fd[0] = notify_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    bool ok = notify_fd[0] >= 0;
+#else
+    bool ok = pipe(notify_fd) == 0;
+    for (int i = 0; ok && i < 2; i++) {
+        fcntl(notify_fd[i], F_SETFL,
+              fcntl(notify_fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(notify_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (!ok) {
+        log_error("Failed to create the worker notification descriptor");
+        return false;
+    }
+    if (!twin_set_file(_twin_job_notified, notify_fd[0], TWIN_READ, NULL))
+        return false;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = ncpu < 1 ? 1 : ncpu > TWIN_WORKER_MAX ? TWIN_WORKER_MAX : ncpu;
+    for (int i = 0; i < want; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, _twin_worker_thread, NULL)) {
+            log_error("Failed to create worker thread");
+            break;
+        }
+        pthread_detach(thread);
+        n_workers++;
+    }
+    return n_workers > 0;
+}
+
+twin_job_t *twin_set_job(twin_job_proc_t job_proc,
+                         twin_job_done_t done_proc,
+                         int priority,
+                         void *closure)
+{
+    twin_job_t *job = malloc(sizeof(twin_job_t));
+    if (!job)
+        return NULL;
+
+    job->priority = priority;
+    job->started = false;
+    job->cancelled = false;
+    job->proc = job_proc;
+    job->done = done_proc;
+    job->closure = closure;
+
+    if (!_twin_worker_init()) {
+        /* No threads to offload to; still report completion asynchronously */
+        job->started = true;
+        (*job_proc)(closure);
+        pthread_mutex_lock(&lock);
+        _twin_job_finish(job);
+        pthread_mutex_unlock(&lock);
+        twin_set_work_once(_twin_job_deliver, TWIN_WORK_LAYOUT, NULL);
+        return job;
+    }
+
+    pthread_mutex_lock(&lock);
+    _twin_queue_insert(&pending, _twin_job_order, &job->queue);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    return job;
+}
+
+void twin_clear_job(twin_job_t *job)
+{
+    bool dequeued;
+
+    pthread_mutex_lock(&lock);
+    job->cancelled = true;
+    dequeued = !job->started;
+    if (dequeued) {
+        _twin_queue_remove(&pending, &job->queue);
+        job->started = true;
+        _twin_job_finish(job);
+    }
+    pthread_mutex_unlock(&lock);
+
+    /* A job already taken by a worker is reported once it returns */
+    if (dequeued)
+        twin_set_work_once(_twin_job_deliver, TWIN_WORK_LAYOUT, NULL);
+}